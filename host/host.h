@@ -0,0 +1,80 @@
+#ifndef _host_h
+#define _host_h
+
+/* What the scenario runner drives in pebble_host.c: the virtual clock, the world outside the
+   watch (phone, battery, buttons, taps) and the framebuffer with its per-frame cost */
+
+#include "pebble.h"
+
+#define HOST_SCREEN_WIDTH 144
+#define HOST_SCREEN_HEIGHT 168
+
+/* One entry per event handed to the app, with the redraw it caused if any */
+typedef struct {
+	uint64_t time;
+	const char *event;
+	uint32_t callback_us;
+	uint32_t render_us;
+	bool rendered;
+	uint32_t draws;
+	uint32_t marks;
+	uint32_t changed;
+	uint32_t writes;
+	size_t heap_used;
+} HostFrameStats;
+
+typedef enum {
+	HOST_PHONE_ACK,
+	HOST_PHONE_NACK,
+	HOST_PHONE_TIMEOUT,
+} HostPhoneMode;
+
+typedef enum {
+	HOST_ACCEL_OFF,
+	HOST_ACCEL_STILL,
+	HOST_ACCEL_WALK,
+	HOST_ACCEL_RUN,
+} HostAccelMode;
+
+typedef void (*HostLoop)(void);
+typedef void (*HostFrameHandler)(const HostFrameStats *stats);
+typedef void (*HostOutboxHandler)(const uint8_t *dict, uint16_t size, AppMessageResult result);
+typedef void (*HostLogHandler)(uint8_t level, const char *file, int line, const char *message);
+
+extern uint8_t host_framebuffer[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH];
+
+// Runner hooks, app_event_loop hands control to the loop until it returns
+void host_set_loop(HostLoop loop);
+void host_set_frame_handler(HostFrameHandler handler);
+void host_set_outbox_handler(HostOutboxHandler handler);
+void host_set_log_handler(HostLogHandler handler);
+void host_set_resource_dir(const char *dir);
+
+// Virtual clock
+void host_set_clock(time_t seconds);
+uint64_t host_now_ms(void);
+void host_advance(uint64_t ms);
+
+// The world outside
+void host_set_clock_24h(bool enabled);
+void host_set_bluetooth(bool connected);
+void host_set_battery(uint8_t percent, bool charging, bool plugged);
+void host_set_phone(HostPhoneMode mode, uint32_t latency_ms);
+void host_set_accel(HostAccelMode mode);
+void host_tap(AccelAxisType axis, int32_t direction);
+bool host_button(ButtonId button, bool long_press);
+AppMessageResult host_deliver(const uint8_t *dict, uint16_t size);
+void host_drop(AppMessageResult reason);
+bool host_exit_requested(void);
+
+// Launch and exit as frames of their own, see app_event_loop
+void host_event_begin(const char *event);
+void host_event_end(void);
+
+// Bookkeeping for the report
+size_t host_heap_peak(void);
+uint32_t host_heap_blocks(void);
+uint32_t host_persist_bytes(void);
+uint32_t host_vibes(void);
+
+#endif
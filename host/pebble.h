@@ -0,0 +1,508 @@
+#ifndef _host_pebble_h
+#define _host_pebble_h
+
+/* Host stand-in for the SDK 2 pebble.h. Only what the app uses is declared, with the SDK's
+   names and signatures, so src/sm_watchapp.c builds unmodified. pebble_host.c implements it
+   on a 144x168 1-bit framebuffer and a virtual clock the scenario runner moves forward */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "resource_ids.auto.h"
+
+/* Generated from appinfo.json, ids follow the media list like the SDK numbers them */
+#define HOST_RESOURCE_ENUM(name, type, file) RESOURCE_ID_##name,
+typedef enum {
+	RESOURCE_ID_INVALID,
+	HOST_RESOURCES(HOST_RESOURCE_ENUM)
+	NUM_HOST_RESOURCES
+} ResourceId;
+
+// Graphics types
+typedef struct GPoint {
+	int16_t x;
+	int16_t y;
+} GPoint;
+#define GPoint(x, y) ((GPoint){(x), (y)})
+
+typedef struct GSize {
+	int16_t w;
+	int16_t h;
+} GSize;
+#define GSize(w, h) ((GSize){(w), (h)})
+
+typedef struct GRect {
+	GPoint origin;
+	GSize size;
+} GRect;
+#define GRect(x, y, w, h) ((GRect){{(x), (y)}, {(w), (h)}})
+#define GRectZero GRect(0, 0, 0, 0)
+
+typedef enum GColor {
+	GColorClear = ~0,
+	GColorBlack = 0,
+	GColorWhite = 1,
+} GColor;
+
+typedef enum {
+	GCornerNone = 0,
+	GCornerTopLeft = 1 << 0,
+	GCornerTopRight = 1 << 1,
+	GCornerBottomLeft = 1 << 2,
+	GCornerBottomRight = 1 << 3,
+	GCornersAll = 0x0f,
+} GCornerMask;
+
+typedef enum {
+	GCompOpAssign,
+	GCompOpAssignInverted,
+	GCompOpOr,
+	GCompOpAnd,
+	GCompOpClear,
+	GCompOpSet,
+} GCompOp;
+
+typedef enum {
+	GTextAlignmentLeft,
+	GTextAlignmentCenter,
+	GTextAlignmentRight,
+} GTextAlignment;
+
+typedef enum {
+	GTextOverflowModeWordWrap,
+	GTextOverflowModeTrailingEllipsis,
+	GTextOverflowModeFill,
+} GTextOverflowMode;
+
+/* 1 bit per pixel, least significant bit first, rows padded to 32 bits like the firmware */
+typedef struct GBitmap {
+	void *addr;
+	uint16_t row_size_bytes;
+	uint16_t info_flags;
+	GRect bounds;
+} GBitmap;
+
+typedef struct GContext GContext;
+typedef struct HostFont *GFont;
+typedef struct HostResource *ResHandle;
+typedef void *GTextLayoutCacheRef;
+
+// Layers and windows
+typedef struct Layer Layer;
+typedef struct Window Window;
+typedef struct TextLayer TextLayer;
+typedef struct BitmapLayer BitmapLayer;
+typedef void (*LayerUpdateProc)(Layer *layer, GContext *ctx);
+
+typedef void (*WindowHandler)(Window *window);
+typedef struct WindowHandlers {
+	WindowHandler load;
+	WindowHandler appear;
+	WindowHandler disappear;
+	WindowHandler unload;
+} WindowHandlers;
+
+typedef enum {
+	BUTTON_ID_BACK,
+	BUTTON_ID_UP,
+	BUTTON_ID_SELECT,
+	BUTTON_ID_DOWN,
+	NUM_BUTTONS,
+} ButtonId;
+
+typedef void *ClickRecognizerRef;
+typedef void (*ClickHandler)(ClickRecognizerRef recognizer, void *context);
+typedef void (*ClickConfigProvider)(void *context);
+
+// Animations
+typedef struct Animation Animation;
+#define ANIMATION_NORMALIZED_MIN 0
+#define ANIMATION_NORMALIZED_MAX 65535
+
+typedef enum {
+	AnimationCurveLinear,
+	AnimationCurveEaseIn,
+	AnimationCurveEaseOut,
+	AnimationCurveEaseInOut,
+} AnimationCurve;
+
+typedef void (*AnimationSetupImplementation)(Animation *animation);
+typedef void (*AnimationUpdateImplementation)(Animation *animation, const uint32_t time_normalized);
+typedef void (*AnimationTeardownImplementation)(Animation *animation);
+typedef struct AnimationImplementation {
+	AnimationSetupImplementation setup;
+	AnimationUpdateImplementation update;
+	AnimationTeardownImplementation teardown;
+} AnimationImplementation;
+
+typedef void (*AnimationStartedHandler)(Animation *animation, void *context);
+typedef void (*AnimationStoppedHandler)(Animation *animation, bool finished, void *context);
+typedef struct AnimationHandlers {
+	AnimationStartedHandler started;
+	AnimationStoppedHandler stopped;
+} AnimationHandlers;
+
+/* Public like in SDK 2, so PropertyAnimation can embed it */
+struct Animation {
+	const AnimationImplementation *implementation;
+	AnimationHandlers handlers;
+	void *context;
+	uint32_t delay_ms;
+	uint32_t duration_ms;
+	AnimationCurve curve;
+	bool scheduled;
+	bool started;
+	uint64_t start_ms;
+};
+
+typedef struct PropertyAnimation {
+	Animation animation;
+	Layer *subject;
+	GRect from;
+	GRect to;
+} PropertyAnimation;
+
+// Dictionaries, the firmware's packed wire format
+typedef enum {
+	TUPLE_BYTE_ARRAY = 0,
+	TUPLE_CSTRING = 1,
+	TUPLE_UINT = 2,
+	TUPLE_INT = 3,
+} TupleType;
+
+typedef struct __attribute__((__packed__)) Tuple {
+	uint32_t key;
+	TupleType type:8;
+	uint16_t length;
+	union {
+		uint8_t data[0];
+		char cstring[0];
+		uint8_t uint8;
+		uint16_t uint16;
+		uint32_t uint32;
+		int8_t int8;
+		int16_t int16;
+		int32_t int32;
+	} value[];
+} Tuple;
+
+typedef struct __attribute__((__packed__)) Dictionary {
+	uint8_t count;
+	Tuple head[];
+} Dictionary;
+
+typedef struct DictionaryIterator {
+	Dictionary *dictionary;
+	const void *end;
+	Tuple *cursor;
+} DictionaryIterator;
+
+typedef enum {
+	DICT_OK = 0,
+	DICT_NOT_ENOUGH_STORAGE = 1 << 1,
+	DICT_INVALID_ARGS = 1 << 2,
+	DICT_INTERNAL_INCONSISTENCY = 1 << 3,
+	DICT_MALLOC_FAILED = 1 << 4,
+} DictionaryResult;
+
+// AppMessage
+typedef enum {
+	APP_MSG_OK = 0,
+	APP_MSG_SEND_TIMEOUT = 1 << 1,
+	APP_MSG_SEND_REJECTED = 1 << 2,
+	APP_MSG_NOT_CONNECTED = 1 << 3,
+	APP_MSG_APP_NOT_RUNNING = 1 << 4,
+	APP_MSG_INVALID_ARGS = 1 << 5,
+	APP_MSG_BUSY = 1 << 6,
+	APP_MSG_BUFFER_OVERFLOW = 1 << 7,
+	APP_MSG_ALREADY_RELEASED = 1 << 9,
+	APP_MSG_CALLBACK_ALREADY_REGISTERED = 1 << 10,
+	APP_MSG_CALLBACK_NOT_REGISTERED = 1 << 11,
+	APP_MSG_OUT_OF_MEMORY = 1 << 12,
+	APP_MSG_CLOSED = 1 << 13,
+	APP_MSG_INTERNAL_ERROR = 1 << 14,
+} AppMessageResult;
+
+typedef void (*AppMessageInboxReceived)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageInboxDropped)(AppMessageResult reason, void *context);
+typedef void (*AppMessageOutboxSent)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageOutboxFailed)(DictionaryIterator *iterator, AppMessageResult reason, void *context);
+
+// Services
+typedef struct AppTimer AppTimer;
+typedef void (*AppTimerCallback)(void *data);
+
+typedef enum {
+	SECOND_UNIT = 1 << 0,
+	MINUTE_UNIT = 1 << 1,
+	HOUR_UNIT = 1 << 2,
+	DAY_UNIT = 1 << 3,
+	MONTH_UNIT = 1 << 4,
+	YEAR_UNIT = 1 << 5,
+} TimeUnits;
+typedef void (*TickHandler)(struct tm *tick_time, TimeUnits units_changed);
+
+typedef struct BatteryChargeState {
+	uint8_t charge_percent;
+	bool is_charging;
+	bool is_plugged;
+} BatteryChargeState;
+typedef void (*BatteryStateHandler)(BatteryChargeState charge);
+typedef void (*BluetoothConnectionHandler)(bool connected);
+
+typedef enum {
+	ACCEL_AXIS_X = 0,
+	ACCEL_AXIS_Y = 1,
+	ACCEL_AXIS_Z = 2,
+} AccelAxisType;
+typedef void (*AccelTapHandler)(AccelAxisType axis, int32_t direction);
+
+typedef struct AccelData {
+	int16_t x;
+	int16_t y;
+	int16_t z;
+	bool did_vibrate;
+	uint64_t timestamp;
+} AccelData;
+typedef void (*AccelDataHandler)(AccelData *data, uint32_t num_samples);
+
+typedef enum {
+	ACCEL_SAMPLING_10HZ = 10,
+	ACCEL_SAMPLING_25HZ = 25,
+	ACCEL_SAMPLING_50HZ = 50,
+	ACCEL_SAMPLING_100HZ = 100,
+} AccelSamplingRate;
+
+typedef enum {
+	S_TRUE = 1,
+	S_FALSE = 0,
+	S_SUCCESS = 0,
+	E_ERROR = -1,
+	E_UNKNOWN = -2,
+	E_INTERNAL = -3,
+	E_INVALID_ARGUMENT = -4,
+	E_OUT_OF_MEMORY = -5,
+	E_OUT_OF_STORAGE = -6,
+	E_OUT_OF_RESOURCES = -7,
+	E_RANGE = -8,
+	E_DOES_NOT_EXIST = -9,
+	E_INVALID_OPERATION = -10,
+	E_BUSY = -11,
+} StatusCode;
+typedef int32_t status_t;
+
+#define PERSIST_DATA_MAX_LENGTH 256
+#define PERSIST_STRING_MAX_LENGTH PERSIST_DATA_MAX_LENGTH
+
+typedef enum {
+	APP_LOG_LEVEL_ERROR = 1,
+	APP_LOG_LEVEL_WARNING = 50,
+	APP_LOG_LEVEL_INFO = 100,
+	APP_LOG_LEVEL_DEBUG = 200,
+	APP_LOG_LEVEL_DEBUG_VERBOSE = 255,
+} AppLogLevel;
+
+#define APP_LOG(level, fmt, args...) app_log(level, __FILE__, __LINE__, fmt, ## args)
+
+// System fonts are stood in for by the Roboto faces in resources/fonts, see host_font_load
+#define FONT_KEY_GOTHIC_14 "RESOURCE_ID_GOTHIC_14"
+#define FONT_KEY_GOTHIC_14_BOLD "RESOURCE_ID_GOTHIC_14_BOLD"
+#define FONT_KEY_GOTHIC_18 "RESOURCE_ID_GOTHIC_18"
+#define FONT_KEY_GOTHIC_18_BOLD "RESOURCE_ID_GOTHIC_18_BOLD"
+#define FONT_KEY_GOTHIC_24 "RESOURCE_ID_GOTHIC_24"
+#define FONT_KEY_GOTHIC_24_BOLD "RESOURCE_ID_GOTHIC_24_BOLD"
+#define FONT_KEY_GOTHIC_28 "RESOURCE_ID_GOTHIC_28"
+#define FONT_KEY_GOTHIC_28_BOLD "RESOURCE_ID_GOTHIC_28_BOLD"
+
+// Graphics
+void graphics_context_set_stroke_color(GContext *ctx, GColor color);
+void graphics_context_set_fill_color(GContext *ctx, GColor color);
+void graphics_context_set_text_color(GContext *ctx, GColor color);
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode);
+void graphics_draw_pixel(GContext *ctx, GPoint point);
+void graphics_draw_line(GContext *ctx, GPoint p0, GPoint p1);
+void graphics_draw_rect(GContext *ctx, GRect rect);
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask);
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect);
+void graphics_draw_text(GContext *ctx, const char *text, GFont const font, const GRect box,
+		const GTextOverflowMode overflow_mode, const GTextAlignment alignment, const GTextLayoutCacheRef layout);
+GSize graphics_text_layout_get_content_size(const char *text, GFont const font, const GRect box,
+		const GTextOverflowMode overflow_mode, const GTextAlignment alignment);
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id);
+void gbitmap_destroy(GBitmap *bitmap);
+
+GFont fonts_get_system_font(const char *font_key);
+GFont fonts_load_custom_font(ResHandle handle);
+void fonts_unload_custom_font(GFont font);
+ResHandle resource_get_handle(uint32_t resource_id);
+size_t resource_size(ResHandle handle);
+
+// Layers
+Layer *layer_create(GRect frame);
+Layer *layer_create_with_data(GRect frame, size_t data_size);
+void layer_destroy(Layer *layer);
+void *layer_get_data(const Layer *layer);
+void layer_mark_dirty(Layer *layer);
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc);
+void layer_set_frame(Layer *layer, GRect frame);
+GRect layer_get_frame(const Layer *layer);
+void layer_set_bounds(Layer *layer, GRect bounds);
+GRect layer_get_bounds(const Layer *layer);
+Window *layer_get_window(const Layer *layer);
+void layer_add_child(Layer *parent, Layer *child);
+void layer_remove_from_parent(Layer *child);
+void layer_set_hidden(Layer *layer, bool hidden);
+bool layer_get_hidden(const Layer *layer);
+
+TextLayer *text_layer_create(GRect frame);
+void text_layer_destroy(TextLayer *text_layer);
+Layer *text_layer_get_layer(TextLayer *text_layer);
+void text_layer_set_text(TextLayer *text_layer, const char *text);
+const char *text_layer_get_text(TextLayer *text_layer);
+void text_layer_set_background_color(TextLayer *text_layer, GColor color);
+void text_layer_set_text_color(TextLayer *text_layer, GColor color);
+void text_layer_set_overflow_mode(TextLayer *text_layer, GTextOverflowMode line_mode);
+void text_layer_set_font(TextLayer *text_layer, GFont font);
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment);
+
+BitmapLayer *bitmap_layer_create(GRect frame);
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer);
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer);
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap);
+void bitmap_layer_set_background_color(BitmapLayer *bitmap_layer, GColor color);
+void bitmap_layer_set_compositing_mode(BitmapLayer *bitmap_layer, GCompOp mode);
+
+// Windows
+Window *window_create(void);
+void window_destroy(Window *window);
+void window_set_click_config_provider(Window *window, ClickConfigProvider click_config_provider);
+void window_set_click_config_provider_with_context(Window *window, ClickConfigProvider click_config_provider,
+		void *context);
+void window_set_window_handlers(Window *window, WindowHandlers handlers);
+Layer *window_get_root_layer(const Window *window);
+void window_set_background_color(Window *window, GColor background_color);
+void window_set_fullscreen(Window *window, bool enabled);
+bool window_get_fullscreen(const Window *window);
+bool window_is_loaded(Window *window);
+void window_stack_push(Window *window, bool animated);
+Window *window_stack_pop(bool animated);
+bool window_stack_remove(Window *window, bool animated);
+Window *window_stack_get_top_window(void);
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler);
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler,
+		ClickHandler up_handler);
+
+// Animations
+Animation *animation_create(void);
+void animation_destroy(Animation *animation);
+void animation_set_delay(Animation *animation, uint32_t delay_ms);
+void animation_set_duration(Animation *animation, uint32_t duration_ms);
+void animation_set_curve(Animation *animation, AnimationCurve curve);
+void animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context);
+void *animation_get_context(Animation *animation);
+void animation_set_implementation(Animation *animation, const AnimationImplementation *implementation);
+void animation_schedule(Animation *animation);
+void animation_unschedule(Animation *animation);
+void animation_unschedule_all(void);
+bool animation_is_scheduled(Animation *animation);
+PropertyAnimation *property_animation_create_layer_frame(Layer *layer, GRect *from_frame, GRect *to_frame);
+void property_animation_destroy(PropertyAnimation *property_animation);
+
+// Dictionaries
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...);
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t * const buffer, const uint16_t size);
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t * const data,
+		const uint16_t size);
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char * const cstring);
+DictionaryResult dict_write_int(DictionaryIterator *iter, const uint32_t key, const void *integer,
+		const uint8_t width_bytes, const bool is_signed);
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value);
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value);
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value);
+DictionaryResult dict_write_int8(DictionaryIterator *iter, const uint32_t key, const int8_t value);
+DictionaryResult dict_write_int16(DictionaryIterator *iter, const uint32_t key, const int16_t value);
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value);
+uint32_t dict_write_end(DictionaryIterator *iter);
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t * const buffer, const uint16_t size);
+Tuple *dict_read_next(DictionaryIterator *iter);
+Tuple *dict_read_first(DictionaryIterator *iter);
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key);
+
+// AppMessage
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound);
+void app_message_deregister_callbacks(void);
+void *app_message_get_context(void);
+void *app_message_set_context(void *context);
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback);
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback);
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback);
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback);
+uint32_t app_message_inbox_size_maximum(void);
+uint32_t app_message_outbox_size_maximum(void);
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator);
+AppMessageResult app_message_outbox_send(void);
+
+// Timers and services
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data);
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms);
+void app_timer_cancel(AppTimer *timer_handle);
+
+void tick_timer_service_subscribe(TimeUnits tick_units, TickHandler handler);
+void tick_timer_service_unsubscribe(void);
+BatteryChargeState battery_state_service_peek(void);
+void battery_state_service_subscribe(BatteryStateHandler handler);
+void battery_state_service_unsubscribe(void);
+bool bluetooth_connection_service_peek(void);
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler);
+void bluetooth_connection_service_unsubscribe(void);
+void accel_tap_service_subscribe(AccelTapHandler handler);
+void accel_tap_service_unsubscribe(void);
+void accel_data_service_subscribe(uint32_t samples_per_update, AccelDataHandler handler);
+void accel_data_service_unsubscribe(void);
+int accel_service_set_sampling_rate(AccelSamplingRate rate);
+
+void vibes_short_pulse(void);
+void vibes_long_pulse(void);
+void vibes_double_pulse(void);
+void vibes_cancel(void);
+
+bool clock_is_24h_style(void);
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms);
+
+bool persist_exists(const uint32_t key);
+int persist_get_size(const uint32_t key);
+int32_t persist_read_int(const uint32_t key);
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size);
+status_t persist_write_int(const uint32_t key, const int32_t value);
+int persist_write_data(const uint32_t key, const void *data, const size_t size);
+status_t persist_delete(const uint32_t key);
+
+size_t heap_bytes_used(void);
+size_t heap_bytes_free(void);
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...);
+void app_event_loop(void);
+
+/* The app sees the virtual clock and the app heap. pebble_host.c defines HOST_INTERNAL and
+   keeps its own bookkeeping out of both */
+time_t host_time(time_t *tloc);
+void *host_app_malloc(size_t size);
+void *host_app_calloc(size_t count, size_t size);
+void *host_app_realloc(void *ptr, size_t size);
+void host_app_free(void *ptr);
+
+#ifndef HOST_INTERNAL
+#define time(tloc) host_time(tloc)
+#define malloc(size) host_app_malloc(size)
+#define calloc(count, size) host_app_calloc(count, size)
+#define realloc(ptr, size) host_app_realloc(ptr, size)
+#define free(ptr) host_app_free(ptr)
+#endif
+
+#endif
@@ -0,0 +1,1913 @@
+#define HOST_INTERNAL
+#include "host.h"
+
+#include <stdarg.h>
+#include <png.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/* The SDK 2 firmware, as far as the app can tell. Everything runs on one thread and a virtual
+   clock: host_advance fires timers, ticks, animation frames and accelerometer batches in time
+   order, and every event ends with a redraw of the top window if a layer was marked dirty */
+
+#ifndef HOST_RESOURCE_DIR
+#define HOST_RESOURCE_DIR "../resources"
+#endif
+
+#define MAX(a, b) (((a) < (b)) ? (b) : (a))
+#define MIN(a, b) (((a) > (b)) ? (b) : (a))
+
+#define STATUS_BAR_HEIGHT 16
+#define HOST_TIMERS 64
+#define HOST_WINDOWS 8
+#define HOST_ANIMATIONS 16
+#define HOST_FONTS 16
+#define HOST_PERSIST_KEYS 256
+#define ANIMATION_FRAME_MS 33
+#define ACCEL_MS_PER_SAMPLE 100
+#define TIMEOUT_MS 3000
+
+// What firmware 2.x reports, the app asks for less
+#define INBOX_SIZE_MAXIMUM 2026
+#define OUTBOX_SIZE_MAXIMUM 656
+
+/* Heap blocks carry a header like the firmware allocator, the app is charged for it */
+#define HEAP_SIZE (24 * 1024)
+#define HEAP_BLOCK_OVERHEAD 8
+
+typedef enum {
+	TIMER_APP,
+	TIMER_OUTBOX,
+} TimerKind;
+
+typedef struct {
+	uint32_t id;
+	TimerKind kind;
+	uint64_t due;
+	AppTimerCallback callback;
+	void *data;
+} HostTimer;
+
+struct Layer {
+	GRect frame;
+	GRect bounds;
+	bool hidden;
+	Layer *parent;
+	Layer *first_child;
+	Layer *next_sibling;
+	Window *window;
+	LayerUpdateProc update_proc;
+	void *data;
+};
+
+struct TextLayer {
+	Layer layer;
+	const char *text;
+	GFont font;
+	GColor text_color;
+	GColor background_color;
+	GTextOverflowMode overflow_mode;
+	GTextAlignment alignment;
+};
+
+struct BitmapLayer {
+	Layer layer;
+	const GBitmap *bitmap;
+	GColor background_color;
+	GCompOp compositing_mode;
+};
+
+struct Window {
+	Layer root;
+	WindowHandlers handlers;
+	ClickConfigProvider click_config_provider;
+	void *click_context;
+	ClickHandler single_click[NUM_BUTTONS];
+	ClickHandler long_click_down[NUM_BUTTONS];
+	ClickHandler long_click_up[NUM_BUTTONS];
+	GColor background_color;
+	bool fullscreen;
+	bool loaded;
+};
+
+struct GContext {
+	GPoint offset;
+	GRect clip;
+	GColor stroke_color;
+	GColor fill_color;
+	GColor text_color;
+	GCompOp compositing_mode;
+};
+
+struct HostFont {
+	FT_Face face;
+	char key[48];
+	int16_t line_height;
+	int16_t ascent;
+	bool custom;
+};
+
+struct HostResource {
+	const char *name;
+	const char *type;
+	const char *file;
+};
+
+typedef struct {
+	uint32_t key;
+	uint16_t size;
+	uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistEntry;
+
+uint8_t host_framebuffer[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH];
+
+static HostLoop host_loop;
+static HostFrameHandler frame_handler;
+static HostOutboxHandler outbox_handler;
+static HostLogHandler log_handler;
+static const char *resource_dir = HOST_RESOURCE_DIR;
+
+static uint64_t now_ms;
+static HostTimer timers[HOST_TIMERS];
+static uint8_t num_timers;
+static uint32_t next_timer_id = 1;
+
+static TickHandler tick_handler;
+static TimeUnits tick_units;
+static BatteryStateHandler battery_handler;
+static BatteryChargeState battery_state = {.charge_percent = 80};
+static BluetoothConnectionHandler bluetooth_handler;
+static bool bluetooth_connected = true;
+static AccelTapHandler tap_handler;
+static AccelDataHandler accel_handler;
+static uint32_t accel_samples;
+static uint64_t accel_next;
+static HostAccelMode accel_mode;
+static bool clock_24h = true;
+static uint32_t vibes;
+
+static Window *window_stack[HOST_WINDOWS];
+static uint8_t window_count;
+static Window *click_config_window;
+static bool exit_requested;
+
+static Animation *animations[HOST_ANIMATIONS];
+static uint8_t animation_count;
+static uint64_t animation_next;
+
+static FT_Library freetype;
+static GFont fonts[HOST_FONTS];
+static uint8_t font_count;
+
+static const struct HostResource RESOURCES[NUM_HOST_RESOURCES] = {
+#define HOST_RESOURCE_ENTRY(name, type, file) [RESOURCE_ID_##name] = {#name, type, file},
+	HOST_RESOURCES(HOST_RESOURCE_ENTRY)
+};
+
+static PersistEntry persist[HOST_PERSIST_KEYS];
+static uint16_t persist_count;
+
+static size_t heap_used, heap_peak;
+static uint32_t heap_blocks;
+
+// Messaging
+static bool message_open;
+static uint32_t inbox_size;
+static uint8_t *inbox_buffer;
+static uint32_t outbox_size;
+static uint8_t *outbox_buffer;
+static DictionaryIterator outbox_iter;
+static bool outbox_begun, outbox_sending;
+static AppMessageResult outbox_result;
+static AppMessageInboxReceived inbox_received;
+static AppMessageInboxDropped inbox_dropped;
+static AppMessageOutboxSent outbox_sent;
+static AppMessageOutboxFailed outbox_failed;
+static void *message_context;
+static HostPhoneMode phone_mode;
+static uint32_t phone_latency = 50;
+
+// Per-frame accounting
+static uint8_t event_depth;
+static HostFrameStats frame;
+static struct timespec event_started;
+static bool render_pending;
+static uint8_t previous_frame[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH];
+
+static uint32_t elapsed_us(const struct timespec *since) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000 + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+// Runner hooks
+void host_set_loop(HostLoop loop) {
+	host_loop = loop;
+}
+
+void host_set_frame_handler(HostFrameHandler handler) {
+	frame_handler = handler;
+}
+
+void host_set_outbox_handler(HostOutboxHandler handler) {
+	outbox_handler = handler;
+}
+
+void host_set_log_handler(HostLogHandler handler) {
+	log_handler = handler;
+}
+
+void host_set_resource_dir(const char *dir) {
+	resource_dir = dir;
+}
+
+// App heap
+typedef struct {
+	size_t size;
+	size_t pad;
+} HeapBlock;
+
+void *host_app_malloc(size_t size) {
+	HeapBlock *block = malloc(sizeof(HeapBlock) + size);
+
+	if(!block) return NULL;
+	block->size = size;
+	heap_used += size + HEAP_BLOCK_OVERHEAD;
+	heap_peak = MAX(heap_peak, heap_used);
+	heap_blocks++;
+	return block + 1;
+}
+
+void *host_app_calloc(size_t count, size_t size) {
+	void *ptr = host_app_malloc(count * size);
+
+	if(ptr) memset(ptr, 0, count * size);
+	return ptr;
+}
+
+void host_app_free(void *ptr) {
+	HeapBlock *block;
+
+	if(!ptr) return;
+	block = (HeapBlock *)ptr - 1;
+	heap_used -= block->size + HEAP_BLOCK_OVERHEAD;
+	heap_blocks--;
+	free(block);
+}
+
+void *host_app_realloc(void *ptr, size_t size) {
+	void *resized;
+
+	if(!ptr) return host_app_malloc(size);
+	resized = host_app_malloc(size);
+	if(!resized) return NULL;
+	memcpy(resized, ptr, MIN(size, ((HeapBlock *)ptr - 1)->size));
+	host_app_free(ptr);
+	return resized;
+}
+
+size_t heap_bytes_used(void) {
+	return heap_used;
+}
+
+size_t heap_bytes_free(void) {
+	return (heap_used < HEAP_SIZE) ? HEAP_SIZE - heap_used : 0;
+}
+
+size_t host_heap_peak(void) {
+	return heap_peak;
+}
+
+uint32_t host_heap_blocks(void) {
+	return heap_blocks;
+}
+
+// Frames
+static void render(void);
+
+void host_event_begin(const char *event) {
+	if(event_depth++) return;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.time = now_ms;
+	frame.event = event;
+	clock_gettime(CLOCK_MONOTONIC, &event_started);
+}
+
+void host_event_end(void) {
+	struct timespec render_started;
+
+	if(--event_depth) return;
+
+	frame.callback_us = elapsed_us(&event_started);
+	if(render_pending && window_count) {
+		clock_gettime(CLOCK_MONOTONIC, &render_started);
+		render();
+		frame.render_us = elapsed_us(&render_started);
+		frame.rendered = true;
+	}
+	frame.heap_used = heap_used;
+	if(frame_handler) frame_handler(&frame);
+}
+
+// Timers
+static AppTimer *timer_add(TimerKind kind, uint32_t timeout_ms, AppTimerCallback callback, void *data) {
+	HostTimer *timer;
+
+	if(num_timers == HOST_TIMERS) return NULL;
+	timer = &timers[num_timers++];
+	timer->id = next_timer_id++;
+	timer->kind = kind;
+	timer->due = now_ms + timeout_ms;
+	timer->callback = callback;
+	timer->data = data;
+	return (AppTimer *)(uintptr_t)timer->id;
+}
+
+/* Handles are ids that are never reused, a stale one is simply not found */
+static HostTimer *timer_find(AppTimer *handle) {
+	uint8_t i;
+
+	for(i = 0; i < num_timers; i++) {
+		if(timers[i].id == (uint32_t)(uintptr_t)handle) return &timers[i];
+	}
+	return NULL;
+}
+
+static void timer_remove(HostTimer *timer) {
+	memmove(timer, timer + 1, (&timers[num_timers] - (timer + 1)) * sizeof(HostTimer));
+	num_timers--;
+}
+
+/* Earliest due first, registration order among equals */
+static HostTimer *timer_next(void) {
+	HostTimer *next = NULL;
+	uint8_t i;
+
+	for(i = 0; i < num_timers; i++) {
+		if(!next || (timers[i].due < next->due)) next = &timers[i];
+	}
+	return next;
+}
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+	return timer_add(TIMER_APP, timeout_ms, callback, callback_data);
+}
+
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms) {
+	HostTimer *timer = timer_find(timer_handle);
+
+	if(!timer) return false;
+	timer->due = now_ms + new_timeout_ms;
+	return true;
+}
+
+void app_timer_cancel(AppTimer *timer_handle) {
+	HostTimer *timer = timer_find(timer_handle);
+
+	if(timer) timer_remove(timer);
+}
+
+// Clock
+void host_set_clock(time_t seconds) {
+	now_ms = (uint64_t)seconds * 1000;
+}
+
+uint64_t host_now_ms(void) {
+	return now_ms;
+}
+
+time_t host_time(time_t *tloc) {
+	time_t seconds = now_ms / 1000;
+
+	if(tloc) *tloc = seconds;
+	return seconds;
+}
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms) {
+	uint16_t ms = now_ms % 1000;
+
+	host_time(tloc);
+	if(out_ms) *out_ms = ms;
+	return ms;
+}
+
+bool clock_is_24h_style(void) {
+	return clock_24h;
+}
+
+void host_set_clock_24h(bool enabled) {
+	clock_24h = enabled;
+}
+
+static uint64_t tick_period(void) {
+	return (tick_units & SECOND_UNIT) ? 1000 : 60 * 1000;
+}
+
+static void fire_tick(void) {
+	time_t seconds = now_ms / 1000;
+	struct tm tick_time = *localtime(&seconds);
+	TimeUnits changed = SECOND_UNIT;
+
+	if(tick_time.tm_sec == 0) changed |= MINUTE_UNIT;
+	if(changed & MINUTE_UNIT && tick_time.tm_min == 0) changed |= HOUR_UNIT;
+	if(changed & HOUR_UNIT && tick_time.tm_hour == 0) changed |= DAY_UNIT;
+	if(changed & DAY_UNIT && tick_time.tm_mday == 1) changed |= MONTH_UNIT;
+	if(changed & MONTH_UNIT && tick_time.tm_mon == 0) changed |= YEAR_UNIT;
+	if(!(changed & tick_units)) return;
+
+	host_event_begin("tick");
+	tick_handler(&tick_time, changed);
+	host_event_end();
+}
+
+static void step_animations(void);
+static void fire_accel(void);
+
+/* Everything due up to the target, in time order: timers, then the tick, then animation frames */
+void host_advance(uint64_t ms) {
+	uint64_t target = now_ms + ms, tick_next, next;
+	HostTimer *timer, fired;
+
+	while(!exit_requested) {
+		timer = timer_next();
+		tick_next = tick_handler ? (now_ms / tick_period() + 1) * tick_period() : UINT64_MAX;
+		next = MIN(timer ? timer->due : UINT64_MAX, tick_next);
+		if(animation_count) next = MIN(next, animation_next);
+		if(accel_handler && accel_mode) next = MIN(next, accel_next);
+		if(next > target) break;
+
+		now_ms = MAX(now_ms, next);
+		if(timer && (timer->due <= now_ms)) {
+			fired = *timer;
+			timer_remove(timer);
+			host_event_begin((fired.kind == TIMER_APP) ? "timer" : (outbox_result == APP_MSG_OK) ? "sent" : "failed");
+			fired.callback(fired.data);
+			host_event_end();
+		} else if(tick_next <= now_ms) {
+			fire_tick();
+		} else if(animation_count && (animation_next <= now_ms)) {
+			step_animations();
+		} else {
+			fire_accel();
+		}
+	}
+	if(!exit_requested) now_ms = target;
+}
+
+// Services
+void tick_timer_service_subscribe(TimeUnits tick_units_, TickHandler handler) {
+	tick_units = tick_units_;
+	tick_handler = handler;
+}
+
+void tick_timer_service_unsubscribe(void) {
+	tick_handler = NULL;
+}
+
+BatteryChargeState battery_state_service_peek(void) {
+	return battery_state;
+}
+
+void battery_state_service_subscribe(BatteryStateHandler handler) {
+	battery_handler = handler;
+}
+
+void battery_state_service_unsubscribe(void) {
+	battery_handler = NULL;
+}
+
+void host_set_battery(uint8_t percent, bool charging, bool plugged) {
+	battery_state = (BatteryChargeState) {.charge_percent = percent, .is_charging = charging, .is_plugged = plugged};
+	if(!battery_handler) return;
+
+	host_event_begin("battery");
+	battery_handler(battery_state);
+	host_event_end();
+}
+
+bool bluetooth_connection_service_peek(void) {
+	return bluetooth_connected;
+}
+
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler) {
+	bluetooth_handler = handler;
+}
+
+void bluetooth_connection_service_unsubscribe(void) {
+	bluetooth_handler = NULL;
+}
+
+void host_set_bluetooth(bool connected) {
+	if(connected == bluetooth_connected) return;
+
+	bluetooth_connected = connected;
+	if(!bluetooth_handler) return;
+
+	host_event_begin("bluetooth");
+	bluetooth_handler(connected);
+	host_event_end();
+}
+
+void accel_tap_service_subscribe(AccelTapHandler handler) {
+	tap_handler = handler;
+}
+
+void accel_tap_service_unsubscribe(void) {
+	tap_handler = NULL;
+}
+
+void host_tap(AccelAxisType axis, int32_t direction) {
+	if(!tap_handler) return;
+
+	host_event_begin("tap");
+	tap_handler(axis, direction);
+	host_event_end();
+}
+
+void accel_data_service_subscribe(uint32_t samples_per_update, AccelDataHandler handler) {
+	accel_handler = handler;
+	accel_samples = MAX(samples_per_update, 1);
+	accel_next = now_ms + accel_samples * ACCEL_MS_PER_SAMPLE;
+}
+
+void accel_data_service_unsubscribe(void) {
+	accel_handler = NULL;
+}
+
+int accel_service_set_sampling_rate(AccelSamplingRate rate) {
+	return 0;
+}
+
+void host_set_accel(HostAccelMode mode) {
+	accel_mode = mode;
+	accel_next = now_ms + accel_samples * ACCEL_MS_PER_SAMPLE;
+}
+
+/* Gravity on z, with a swing per sample that grows with the activity */
+static void fire_accel(void) {
+	static const int16_t SWING[] = {0, 0, 300, 900};
+	AccelData samples[accel_samples];
+	uint32_t i;
+
+	accel_next = now_ms + accel_samples * ACCEL_MS_PER_SAMPLE;
+	for(i = 0; i < accel_samples; i++) {
+		samples[i] = (AccelData) {
+			.x = (i & 1) ? SWING[accel_mode] / 3 : 0,
+			.y = 0,
+			.z = -1000 + ((i & 1) ? SWING[accel_mode] : 0),
+			.timestamp = now_ms - (accel_samples - i) * ACCEL_MS_PER_SAMPLE,
+		};
+	}
+
+	host_event_begin("accel");
+	accel_handler(samples, accel_samples);
+	host_event_end();
+}
+
+void vibes_short_pulse(void) {
+	vibes++;
+}
+
+void vibes_long_pulse(void) {
+	vibes++;
+}
+
+void vibes_double_pulse(void) {
+	vibes++;
+}
+
+void vibes_cancel(void) {
+}
+
+uint32_t host_vibes(void) {
+	return vibes;
+}
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...) {
+	char message[256];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+	if(log_handler) log_handler(log_level, src_filename, src_line_number, message);
+}
+
+/* Hands the scenario the watch until it is done with it, launch and exit are frames of their own */
+void app_event_loop(void) {
+	host_event_end();
+	if(host_loop) host_loop();
+	host_event_begin("exit");
+}
+
+bool host_exit_requested(void) {
+	bool requested = exit_requested;
+
+	exit_requested = false;
+	return requested;
+}
+
+// Persist
+static PersistEntry *persist_find(uint32_t key) {
+	uint16_t i;
+
+	for(i = 0; i < persist_count; i++) {
+		if(persist[i].key == key) return &persist[i];
+	}
+	return NULL;
+}
+
+bool persist_exists(const uint32_t key) {
+	return persist_find(key) != NULL;
+}
+
+int persist_get_size(const uint32_t key) {
+	PersistEntry *entry = persist_find(key);
+
+	return entry ? entry->size : E_DOES_NOT_EXIST;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size) {
+	PersistEntry *entry = persist_find(key);
+	size_t size;
+
+	if(!entry) return E_DOES_NOT_EXIST;
+	size = MIN(buffer_size, entry->size);
+	memcpy(buffer, entry->data, size);
+	return size;
+}
+
+int32_t persist_read_int(const uint32_t key) {
+	int32_t value = 0;
+
+	persist_read_data(key, &value, sizeof(value));
+	return value;
+}
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size) {
+	PersistEntry *entry = persist_find(key);
+
+	if(!entry) {
+		if(persist_count == HOST_PERSIST_KEYS) return E_OUT_OF_STORAGE;
+		entry = &persist[persist_count++];
+		entry->key = key;
+	}
+	entry->size = MIN(size, PERSIST_DATA_MAX_LENGTH);
+	memcpy(entry->data, data, entry->size);
+	return entry->size;
+}
+
+status_t persist_write_int(const uint32_t key, const int32_t value) {
+	return persist_write_data(key, &value, sizeof(value));
+}
+
+status_t persist_delete(const uint32_t key) {
+	PersistEntry *entry = persist_find(key);
+
+	if(!entry) return E_DOES_NOT_EXIST;
+	*entry = persist[--persist_count];
+	return S_SUCCESS;
+}
+
+uint32_t host_persist_bytes(void) {
+	uint32_t bytes = 0;
+	uint16_t i;
+
+	for(i = 0; i < persist_count; i++)
+		bytes += persist[i].size;
+	return bytes;
+}
+
+// Dictionaries
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...) {
+	uint32_t size = sizeof(Dictionary) + tuple_count * sizeof(Tuple);
+	va_list args;
+	uint8_t i;
+
+	va_start(args, tuple_count);
+	for(i = 0; i < tuple_count; i++)
+		size += va_arg(args, uint32_t);
+	va_end(args);
+	return size;
+}
+
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t * const buffer, const uint16_t size) {
+	if(!iter || !buffer || (size < sizeof(Dictionary))) return DICT_INVALID_ARGS;
+
+	iter->dictionary = (Dictionary *)buffer;
+	iter->dictionary->count = 0;
+	iter->cursor = iter->dictionary->head;
+	iter->end = buffer + size;
+	return DICT_OK;
+}
+
+static DictionaryResult dict_write_tuple(DictionaryIterator *iter, uint32_t key, TupleType type,
+		const void *data, uint16_t length) {
+	Tuple *t = iter->cursor;
+
+	if(!iter->dictionary) return DICT_INVALID_ARGS;
+	if((uint8_t *)t->value->data + length > (uint8_t *)iter->end) return DICT_NOT_ENOUGH_STORAGE;
+
+	t->key = key;
+	t->type = type;
+	t->length = length;
+	memcpy(t->value->data, data, length);
+	iter->cursor = (Tuple *)(t->value->data + length);
+	iter->dictionary->count++;
+	return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t * const data,
+		const uint16_t size) {
+	return dict_write_tuple(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char * const cstring) {
+	return dict_write_tuple(iter, key, TUPLE_CSTRING, cstring ? cstring : "", cstring ? strlen(cstring) + 1 : 1);
+}
+
+DictionaryResult dict_write_int(DictionaryIterator *iter, const uint32_t key, const void *integer,
+		const uint8_t width_bytes, const bool is_signed) {
+	if((width_bytes != 1) && (width_bytes != 2) && (width_bytes != 4)) return DICT_INVALID_ARGS;
+
+	return dict_write_tuple(iter, key, is_signed ? TUPLE_INT : TUPLE_UINT, integer, width_bytes);
+}
+
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value) {
+	return dict_write_int(iter, key, &value, sizeof(value), false);
+}
+
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value) {
+	return dict_write_int(iter, key, &value, sizeof(value), false);
+}
+
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value) {
+	return dict_write_int(iter, key, &value, sizeof(value), false);
+}
+
+DictionaryResult dict_write_int8(DictionaryIterator *iter, const uint32_t key, const int8_t value) {
+	return dict_write_int(iter, key, &value, sizeof(value), true);
+}
+
+DictionaryResult dict_write_int16(DictionaryIterator *iter, const uint32_t key, const int16_t value) {
+	return dict_write_int(iter, key, &value, sizeof(value), true);
+}
+
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value) {
+	return dict_write_int(iter, key, &value, sizeof(value), true);
+}
+
+uint32_t dict_write_end(DictionaryIterator *iter) {
+	if(!iter->dictionary) return 0;
+
+	iter->end = iter->cursor;
+	return (uint8_t *)iter->end - (uint8_t *)iter->dictionary;
+}
+
+/* The tuple at the cursor if it lies whole inside the buffer, the cursor moves past it */
+static Tuple *dict_read_tuple(DictionaryIterator *iter) {
+	Tuple *t = iter->cursor;
+
+	if((uint8_t *)t->value->data > (uint8_t *)iter->end) return NULL;
+	if((uint8_t *)t->value->data + t->length > (uint8_t *)iter->end) return NULL;
+
+	iter->cursor = (Tuple *)(t->value->data + t->length);
+	return t;
+}
+
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t * const buffer, const uint16_t size) {
+	if(!iter || !buffer || (size < sizeof(Dictionary))) return NULL;
+
+	iter->dictionary = (Dictionary *)buffer;
+	iter->end = buffer + size;
+	iter->cursor = iter->dictionary->head;
+	return dict_read_tuple(iter);
+}
+
+Tuple *dict_read_next(DictionaryIterator *iter) {
+	return dict_read_tuple(iter);
+}
+
+Tuple *dict_read_first(DictionaryIterator *iter) {
+	iter->cursor = iter->dictionary->head;
+	return dict_read_tuple(iter);
+}
+
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key) {
+	DictionaryIterator scan = *iter;
+	Tuple *t;
+
+	for(t = dict_read_first(&scan); t; t = dict_read_next(&scan)) {
+		if(t->key == key) return t;
+	}
+	return NULL;
+}
+
+// AppMessage
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound) {
+	if(message_open) return APP_MSG_INVALID_ARGS;
+	if((size_inbound > INBOX_SIZE_MAXIMUM) || (size_outbound > OUTBOX_SIZE_MAXIMUM)) return APP_MSG_OUT_OF_MEMORY;
+
+	inbox_size = size_inbound;
+	outbox_size = size_outbound;
+	inbox_buffer = malloc(inbox_size);
+	outbox_buffer = malloc(outbox_size);
+	message_open = true;
+	return APP_MSG_OK;
+}
+
+void app_message_deregister_callbacks(void) {
+	inbox_received = NULL;
+	inbox_dropped = NULL;
+	outbox_sent = NULL;
+	outbox_failed = NULL;
+	message_context = NULL;
+}
+
+void *app_message_get_context(void) {
+	return message_context;
+}
+
+void *app_message_set_context(void *context) {
+	void *previous = message_context;
+
+	message_context = context;
+	return previous;
+}
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback) {
+	AppMessageInboxReceived previous = inbox_received;
+
+	inbox_received = received_callback;
+	return previous;
+}
+
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped dropped_callback) {
+	AppMessageInboxDropped previous = inbox_dropped;
+
+	inbox_dropped = dropped_callback;
+	return previous;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback) {
+	AppMessageOutboxSent previous = outbox_sent;
+
+	outbox_sent = sent_callback;
+	return previous;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback) {
+	AppMessageOutboxFailed previous = outbox_failed;
+
+	outbox_failed = failed_callback;
+	return previous;
+}
+
+uint32_t app_message_inbox_size_maximum(void) {
+	return INBOX_SIZE_MAXIMUM;
+}
+
+uint32_t app_message_outbox_size_maximum(void) {
+	return OUTBOX_SIZE_MAXIMUM;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator) {
+	if(!message_open || !iterator) return APP_MSG_INVALID_ARGS;
+	if(outbox_begun || outbox_sending) return APP_MSG_BUSY;
+
+	dict_write_begin(&outbox_iter, outbox_buffer, outbox_size);
+	outbox_begun = true;
+	*iterator = &outbox_iter;
+	return APP_MSG_OK;
+}
+
+/* The phone's answer, or the lack of one, comes back as the sent or failed callback */
+static void outbox_complete(void *data) {
+	DictionaryIterator iter;
+	uint16_t size = (uint8_t *)outbox_iter.cursor - outbox_buffer;
+
+	outbox_sending = false;
+	outbox_begun = false;
+	if(outbox_handler) outbox_handler(outbox_buffer, size, outbox_result);
+
+	dict_read_begin_from_buffer(&iter, outbox_buffer, size);
+	if(outbox_result == APP_MSG_OK) {
+		if(outbox_sent) outbox_sent(&iter, message_context);
+	} else if(outbox_failed) {
+		outbox_failed(&iter, outbox_result, message_context);
+	}
+}
+
+AppMessageResult app_message_outbox_send(void) {
+	uint32_t delay = phone_latency;
+
+	if(!outbox_begun) return APP_MSG_INVALID_ARGS;
+	if(outbox_sending) return APP_MSG_BUSY;
+
+	if(!bluetooth_connected) {
+		outbox_result = APP_MSG_NOT_CONNECTED;
+	} else if(phone_mode == HOST_PHONE_NACK) {
+		outbox_result = APP_MSG_SEND_REJECTED;
+	} else if(phone_mode == HOST_PHONE_TIMEOUT) {
+		outbox_result = APP_MSG_SEND_TIMEOUT;
+		delay = TIMEOUT_MS;
+	} else {
+		outbox_result = APP_MSG_OK;
+	}
+	outbox_sending = true;
+	timer_add(TIMER_OUTBOX, delay, outbox_complete, NULL);
+	return APP_MSG_OK;
+}
+
+void host_set_phone(HostPhoneMode mode, uint32_t latency_ms) {
+	phone_mode = mode;
+	phone_latency = latency_ms;
+}
+
+AppMessageResult host_deliver(const uint8_t *dict, uint16_t size) {
+	DictionaryIterator iter;
+
+	if(!message_open || !inbox_received) return APP_MSG_CLOSED;
+	if(size > inbox_size) {
+		host_drop(APP_MSG_BUFFER_OVERFLOW);
+		return APP_MSG_BUFFER_OVERFLOW;
+	}
+
+	memcpy(inbox_buffer, dict, size);
+	dict_read_begin_from_buffer(&iter, inbox_buffer, size);
+	host_event_begin("inbox");
+	inbox_received(&iter, message_context);
+	host_event_end();
+	return APP_MSG_OK;
+}
+
+void host_drop(AppMessageResult reason) {
+	if(!message_open || !inbox_dropped) return;
+
+	host_event_begin("dropped");
+	inbox_dropped(reason, message_context);
+	host_event_end();
+}
+
+// Resources
+ResHandle resource_get_handle(uint32_t resource_id) {
+	if((resource_id == RESOURCE_ID_INVALID) || (resource_id >= NUM_HOST_RESOURCES)) return NULL;
+
+	return (ResHandle)&RESOURCES[resource_id];
+}
+
+static FILE *resource_open(ResHandle handle, const char *mode) {
+	char path[512];
+
+	snprintf(path, sizeof(path), "%s/%s", resource_dir, handle->file);
+	return fopen(path, mode);
+}
+
+size_t resource_size(ResHandle handle) {
+	FILE *file = handle ? resource_open(handle, "rb") : NULL;
+	long size;
+
+	if(!file) return 0;
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fclose(file);
+	return size;
+}
+
+/* Converted like the SDK's 1-bit bitmaps: opaque light pixels are white, the rest black */
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id) {
+	ResHandle handle = resource_get_handle(resource_id);
+	png_image image;
+	uint8_t *pixels, *data;
+	GBitmap *bitmap;
+	uint16_t row_size;
+	FILE *file;
+	int x, y;
+
+	if(!handle || strcmp(handle->type, "png") || !(file = resource_open(handle, "rb"))) return NULL;
+
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if(!png_image_begin_read_from_stdio(&image, file)) {
+		fclose(file);
+		return NULL;
+	}
+	image.format = PNG_FORMAT_GA;
+	pixels = malloc(PNG_IMAGE_SIZE(image));
+	png_image_finish_read(&image, NULL, pixels, 0, NULL);
+	fclose(file);
+
+	row_size = (image.width + 31) / 32 * 4;
+	bitmap = host_app_malloc(sizeof(GBitmap));
+	data = host_app_calloc(row_size, image.height);
+	for(y = 0; y < image.height; y++) {
+		for(x = 0; x < image.width; x++) {
+			if((pixels[(y * image.width + x) * 2] >= 128) && (pixels[(y * image.width + x) * 2 + 1] >= 128))
+				data[y * row_size + x / 8] |= 1 << (x % 8);
+		}
+	}
+	free(pixels);
+
+	*bitmap = (GBitmap) {.addr = data, .row_size_bytes = row_size, .bounds = GRect(0, 0, image.width, image.height)};
+	return bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap) {
+	if(!bitmap) return;
+
+	host_app_free(bitmap->addr);
+	host_app_free(bitmap);
+}
+
+// Fonts
+/* Gothic stands in as Roboto Condensed, bold as Roboto Bold, at the same pixel size */
+static GFont font_load(const char *key, const char *file, int16_t size, bool custom) {
+	char path[512];
+	GFont font;
+
+	if(!freetype && FT_Init_FreeType(&freetype)) return NULL;
+
+	font = calloc(1, sizeof(struct HostFont));
+	snprintf(path, sizeof(path), "%s/%s", resource_dir, file);
+	if(FT_New_Face(freetype, path, 0, &font->face)) {
+		free(font);
+		return NULL;
+	}
+	FT_Set_Pixel_Sizes(font->face, 0, size);
+	snprintf(font->key, sizeof(font->key), "%s", key);
+	font->line_height = size;
+	font->ascent = (font->face->size->metrics.ascender >> 6) * size / (font->face->size->metrics.height >> 6);
+	font->custom = custom;
+	return font;
+}
+
+static int16_t font_size(const char *name) {
+	const char *digits = name + strlen(name);
+
+	while((digits > name) && (digits[-1] >= '0') && (digits[-1] <= '9'))
+		digits--;
+	return atoi(digits);
+}
+
+GFont fonts_get_system_font(const char *font_key) {
+	char name[48];
+	uint8_t i;
+
+	for(i = 0; i < font_count; i++) {
+		if(!strcmp(fonts[i]->key, font_key)) return fonts[i];
+	}
+	if(font_count == HOST_FONTS) return NULL;
+
+	snprintf(name, sizeof(name), "%s", font_key);
+	if(strstr(name, "_BOLD")) *strstr(name, "_BOLD") = '\0';
+	fonts[font_count] = font_load(font_key, strstr(font_key, "_BOLD") ? "fonts/Roboto-Bold.ttf" :
+			"fonts/Roboto-Condensed.ttf", font_size(name), false);
+	return fonts[font_count] ? fonts[font_count++] : NULL;
+}
+
+GFont fonts_load_custom_font(ResHandle handle) {
+	if(!handle || strcmp(handle->type, "font")) return NULL;
+
+	return font_load(handle->name, handle->file, font_size(handle->name), true);
+}
+
+void fonts_unload_custom_font(GFont font) {
+	if(!font || !font->custom) return;
+
+	FT_Done_Face(font->face);
+	free(font);
+}
+
+// Drawing
+void graphics_context_set_stroke_color(GContext *ctx, GColor color) {
+	ctx->stroke_color = color;
+}
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color) {
+	ctx->fill_color = color;
+}
+
+void graphics_context_set_text_color(GContext *ctx, GColor color) {
+	ctx->text_color = color;
+}
+
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode) {
+	ctx->compositing_mode = mode;
+}
+
+/* Layer coordinates, clipped to the layer and its parents */
+static void plot(GContext *ctx, int x, int y, GColor color) {
+	x += ctx->offset.x;
+	y += ctx->offset.y;
+	if((color == GColorClear) || (x < ctx->clip.origin.x) || (y < ctx->clip.origin.y) ||
+			(x >= ctx->clip.origin.x + ctx->clip.size.w) || (y >= ctx->clip.origin.y + ctx->clip.size.h))
+		return;
+
+	host_framebuffer[y][x] = color;
+	frame.writes++;
+}
+
+void graphics_draw_pixel(GContext *ctx, GPoint point) {
+	frame.draws++;
+	plot(ctx, point.x, point.y, ctx->stroke_color);
+}
+
+void graphics_draw_line(GContext *ctx, GPoint p0, GPoint p1) {
+	int dx = abs(p1.x - p0.x), dy = -abs(p1.y - p0.y), sx = (p0.x < p1.x) ? 1 : -1, sy = (p0.y < p1.y) ? 1 : -1;
+	int error = dx + dy, x = p0.x, y = p0.y;
+
+	frame.draws++;
+	for(;;) {
+		plot(ctx, x, y, ctx->stroke_color);
+		if((x == p1.x) && (y == p1.y)) break;
+		if(2 * error >= dy) {
+			error += dy;
+			x += sx;
+		}
+		if(2 * error <= dx) {
+			error += dx;
+			y += sy;
+		}
+	}
+}
+
+void graphics_draw_rect(GContext *ctx, GRect rect) {
+	int x, y;
+
+	frame.draws++;
+	for(x = rect.origin.x; x < rect.origin.x + rect.size.w; x++) {
+		plot(ctx, x, rect.origin.y, ctx->stroke_color);
+		plot(ctx, x, rect.origin.y + rect.size.h - 1, ctx->stroke_color);
+	}
+	for(y = rect.origin.y + 1; y < rect.origin.y + rect.size.h - 1; y++) {
+		plot(ctx, rect.origin.x, y, ctx->stroke_color);
+		plot(ctx, rect.origin.x + rect.size.w - 1, y, ctx->stroke_color);
+	}
+}
+
+/* Corners are square, the app only fills with a zero radius */
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask) {
+	int x, y;
+
+	frame.draws++;
+	for(y = rect.origin.y; y < rect.origin.y + rect.size.h; y++) {
+		for(x = rect.origin.x; x < rect.origin.x + rect.size.w; x++)
+			plot(ctx, x, y, ctx->fill_color);
+	}
+}
+
+static GColor composite(GCompOp mode, bool source) {
+	switch(mode) {
+		case GCompOpAssign:			return source ? GColorWhite : GColorBlack;
+		case GCompOpAssignInverted:	return source ? GColorBlack : GColorWhite;
+		case GCompOpOr:				return source ? GColorWhite : GColorClear;
+		case GCompOpAnd:			return source ? GColorClear : GColorBlack;
+		case GCompOpClear:			return source ? GColorBlack : GColorClear;
+		case GCompOpSet:			return source ? GColorClear : GColorWhite;
+	}
+	return GColorClear;
+}
+
+/* The bitmap tiles the rectangle like on the watch */
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect) {
+	const uint8_t *data;
+	int x, y, bx, by;
+	bool source;
+
+	if(!bitmap || (bitmap->bounds.size.w <= 0) || (bitmap->bounds.size.h <= 0)) return;
+
+	frame.draws++;
+	data = bitmap->addr;
+	for(y = 0; y < rect.size.h; y++) {
+		by = bitmap->bounds.origin.y + y % bitmap->bounds.size.h;
+		for(x = 0; x < rect.size.w; x++) {
+			bx = bitmap->bounds.origin.x + x % bitmap->bounds.size.w;
+			source = data[by * bitmap->row_size_bytes + bx / 8] & (1 << (bx % 8));
+			plot(ctx, rect.origin.x + x, rect.origin.y + y, composite(ctx->compositing_mode, source));
+		}
+	}
+}
+
+// Text
+static uint32_t utf8_next(const char **text) {
+	const uint8_t *p = (const uint8_t *)*text;
+	uint32_t codepoint = *p++;
+	uint8_t extra = (codepoint >= 0xf0) ? 3 : (codepoint >= 0xe0) ? 2 : (codepoint >= 0xc0) ? 1 : 0;
+
+	codepoint &= (extra == 3) ? 0x07 : (extra == 2) ? 0x0f : (extra == 1) ? 0x1f : 0x7f;
+	while(extra-- && ((*p & 0xc0) == 0x80))
+		codepoint = (codepoint << 6) | (*p++ & 0x3f);
+	*text = (const char *)p;
+	return codepoint;
+}
+
+static int16_t glyph_advance(GFont font, uint32_t codepoint) {
+	if(FT_Load_Char(font->face, codepoint, FT_LOAD_TARGET_MONO)) return 0;
+
+	return font->face->glyph->advance.x >> 6;
+}
+
+static int16_t text_width(GFont font, const char *text, const char *end) {
+	int16_t width = 0;
+
+	while(text < end)
+		width += glyph_advance(font, utf8_next(&text));
+	return width;
+}
+
+static int16_t glyph_draw(GContext *ctx, GFont font, uint32_t codepoint, int16_t x, int16_t baseline, GRect box) {
+	FT_GlyphSlot glyph;
+	int row, col, px, py;
+
+	if(FT_Load_Char(font->face, codepoint, FT_LOAD_RENDER | FT_LOAD_TARGET_MONO)) return 0;
+
+	glyph = font->face->glyph;
+	for(row = 0; row < (int)glyph->bitmap.rows; row++) {
+		py = baseline - glyph->bitmap_top + row;
+		for(col = 0; col < (int)glyph->bitmap.width; col++) {
+			px = x + glyph->bitmap_left + col;
+			if((px < box.origin.x) || (px >= box.origin.x + box.size.w)) continue;
+			if(glyph->bitmap.buffer[row * glyph->bitmap.pitch + col / 8] & (0x80 >> (col % 8)))
+				plot(ctx, px, py, ctx->text_color);
+		}
+	}
+	return glyph->advance.x >> 6;
+}
+
+/* End of the longest run of whole words from text that fits width, *next is where the
+   following line starts. A word wider than a line is cut between characters */
+static const char *text_line(GFont font, const char *text, int16_t width, const char **next) {
+	const char *p = text, *end = text, *word;
+	int16_t used = 0, word_width;
+
+	for(;;) {
+		word = p;
+		word_width = 0;
+		while(*p == ' ')
+			word_width += glyph_advance(font, utf8_next(&p));
+		while(*p && (*p != ' ') && (*p != '\n'))
+			word_width += glyph_advance(font, utf8_next(&p));
+
+		if(used + word_width > width) {
+			if(end != text) break;
+			// Nothing fits yet, take as many characters as do
+			for(p = word, end = word; *p; end = p) {
+				used += glyph_advance(font, utf8_next(&p));
+				if((used > width) && (end != text)) break;
+			}
+			if(*end == ' ') end++;
+			*next = end;
+			return end;
+		}
+		used += word_width;
+		end = p;
+		if(!*p || (*p == '\n')) break;
+	}
+
+	*next = end;
+	while(**next == ' ')
+		(*next)++;
+	if(**next == '\n') (*next)++;
+	return end;
+}
+
+static void text_layout(GContext *ctx, const char *text, GFont font, GRect box, GTextOverflowMode overflow_mode,
+		GTextAlignment alignment, GSize *size) {
+	static const char ELLIPSIS[] = "\xe2\x80\xa6";
+	const char *line, *end, *next, *p;
+	int16_t y = 0, width, x, ellipsis_width;
+	bool last;
+
+	*size = GSize(0, 0);
+	if(!text || !font) return;
+
+	for(line = text; *line; line = next) {
+		end = text_line(font, line, box.size.w, &next);
+		last = (y + 2 * font->line_height > box.size.h) && *next;
+		if(last && (overflow_mode == GTextOverflowModeTrailingEllipsis)) {
+			// Drop characters until the ellipsis fits after them
+			ellipsis_width = text_width(font, ELLIPSIS, ELLIPSIS + 3);
+			while((end > line) && (text_width(font, line, end) + ellipsis_width > box.size.w)) {
+				do end--; while((end > line) && ((*end & 0xc0) == 0x80));
+			}
+		}
+		while((end > line) && (end[-1] == ' '))
+			end--;
+
+		width = text_width(font, line, end) + ((last && (overflow_mode == GTextOverflowModeTrailingEllipsis)) ?
+				text_width(font, ELLIPSIS, ELLIPSIS + 3) : 0);
+		size->w = MAX(size->w, width);
+		size->h = y + font->line_height;
+		if(ctx) {
+			x = box.origin.x + ((alignment == GTextAlignmentCenter) ? (box.size.w - width) / 2 :
+					(alignment == GTextAlignmentRight) ? box.size.w - width : 0);
+			for(p = line; p < end; )
+				x += glyph_draw(ctx, font, utf8_next(&p), x, box.origin.y + y + font->ascent, box);
+			if(last && (overflow_mode == GTextOverflowModeTrailingEllipsis))
+				glyph_draw(ctx, font, 0x2026, x, box.origin.y + y + font->ascent, box);
+		}
+
+		y += font->line_height;
+		if(last || (y + font->line_height > box.size.h)) break;
+	}
+}
+
+void graphics_draw_text(GContext *ctx, const char *text, GFont const font, const GRect box,
+		const GTextOverflowMode overflow_mode, const GTextAlignment alignment, const GTextLayoutCacheRef layout) {
+	GSize size;
+
+	frame.draws++;
+	text_layout(ctx, text, font, box, overflow_mode, alignment, &size);
+}
+
+GSize graphics_text_layout_get_content_size(const char *text, GFont const font, const GRect box,
+		const GTextOverflowMode overflow_mode, const GTextAlignment alignment) {
+	GSize size;
+
+	text_layout(NULL, text, font, box, overflow_mode, alignment, &size);
+	return size;
+}
+
+// Layers
+static void layer_init(Layer *layer, GRect frame) {
+	memset(layer, 0, sizeof(Layer));
+	layer->frame = frame;
+	layer->bounds = GRect(0, 0, frame.size.w, frame.size.h);
+}
+
+Layer *layer_create(GRect frame) {
+	return layer_create_with_data(frame, 0);
+}
+
+Layer *layer_create_with_data(GRect frame, size_t data_size) {
+	Layer *layer = host_app_calloc(1, sizeof(Layer) + data_size);
+
+	layer_init(layer, frame);
+	layer->data = data_size ? layer + 1 : NULL;
+	return layer;
+}
+
+void layer_destroy(Layer *layer) {
+	if(!layer) return;
+
+	layer_remove_from_parent(layer);
+	host_app_free(layer);
+}
+
+void *layer_get_data(const Layer *layer) {
+	return layer->data;
+}
+
+void layer_mark_dirty(Layer *layer) {
+	frame.marks++;
+	render_pending = true;
+}
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {
+	layer->update_proc = update_proc;
+}
+
+void layer_set_frame(Layer *layer, GRect frame) {
+	layer->frame = frame;
+	layer->bounds.size = frame.size;
+	layer_mark_dirty(layer);
+}
+
+GRect layer_get_frame(const Layer *layer) {
+	return layer->frame;
+}
+
+void layer_set_bounds(Layer *layer, GRect bounds) {
+	layer->bounds = bounds;
+	layer_mark_dirty(layer);
+}
+
+GRect layer_get_bounds(const Layer *layer) {
+	return layer->bounds;
+}
+
+Window *layer_get_window(const Layer *layer) {
+	return layer->window;
+}
+
+static void layer_set_window(Layer *layer, Window *window) {
+	Layer *child;
+
+	layer->window = window;
+	for(child = layer->first_child; child; child = child->next_sibling)
+		layer_set_window(child, window);
+}
+
+void layer_add_child(Layer *parent, Layer *child) {
+	Layer **last = &parent->first_child;
+
+	layer_remove_from_parent(child);
+	while(*last)
+		last = &(*last)->next_sibling;
+	*last = child;
+	child->parent = parent;
+	layer_set_window(child, parent->window);
+	layer_mark_dirty(parent);
+}
+
+void layer_remove_from_parent(Layer *child) {
+	Layer **link;
+
+	if(!child->parent) return;
+
+	for(link = &child->parent->first_child; *link != child; link = &(*link)->next_sibling);
+	*link = child->next_sibling;
+	layer_mark_dirty(child->parent);
+	child->parent = NULL;
+	child->next_sibling = NULL;
+	layer_set_window(child, NULL);
+}
+
+void layer_set_hidden(Layer *layer, bool hidden) {
+	if(layer->hidden == hidden) return;
+
+	layer->hidden = hidden;
+	layer_mark_dirty(layer);
+}
+
+bool layer_get_hidden(const Layer *layer) {
+	return layer->hidden;
+}
+
+static void text_layer_update(Layer *layer, GContext *ctx) {
+	TextLayer *text_layer = (TextLayer *)layer;
+
+	if(text_layer->background_color != GColorClear) {
+		graphics_context_set_fill_color(ctx, text_layer->background_color);
+		graphics_fill_rect(ctx, layer->bounds, 0, GCornerNone);
+	}
+	graphics_context_set_text_color(ctx, text_layer->text_color);
+	graphics_draw_text(ctx, text_layer->text, text_layer->font, layer->bounds, text_layer->overflow_mode,
+			text_layer->alignment, NULL);
+}
+
+TextLayer *text_layer_create(GRect frame) {
+	TextLayer *text_layer = host_app_calloc(1, sizeof(TextLayer));
+
+	layer_init(&text_layer->layer, frame);
+	text_layer->layer.update_proc = text_layer_update;
+	text_layer->font = fonts_get_system_font(FONT_KEY_GOTHIC_14_BOLD);
+	text_layer->text_color = GColorBlack;
+	text_layer->background_color = GColorWhite;
+	text_layer->overflow_mode = GTextOverflowModeWordWrap;
+	text_layer->alignment = GTextAlignmentLeft;
+	return text_layer;
+}
+
+void text_layer_destroy(TextLayer *text_layer) {
+	if(!text_layer) return;
+
+	layer_remove_from_parent(&text_layer->layer);
+	host_app_free(text_layer);
+}
+
+Layer *text_layer_get_layer(TextLayer *text_layer) {
+	return &text_layer->layer;
+}
+
+void text_layer_set_text(TextLayer *text_layer, const char *text) {
+	text_layer->text = text;
+	layer_mark_dirty(&text_layer->layer);
+}
+
+const char *text_layer_get_text(TextLayer *text_layer) {
+	return text_layer->text;
+}
+
+void text_layer_set_background_color(TextLayer *text_layer, GColor color) {
+	text_layer->background_color = color;
+	layer_mark_dirty(&text_layer->layer);
+}
+
+void text_layer_set_text_color(TextLayer *text_layer, GColor color) {
+	text_layer->text_color = color;
+	layer_mark_dirty(&text_layer->layer);
+}
+
+void text_layer_set_overflow_mode(TextLayer *text_layer, GTextOverflowMode line_mode) {
+	text_layer->overflow_mode = line_mode;
+	layer_mark_dirty(&text_layer->layer);
+}
+
+void text_layer_set_font(TextLayer *text_layer, GFont font) {
+	text_layer->font = font;
+	layer_mark_dirty(&text_layer->layer);
+}
+
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment) {
+	text_layer->alignment = text_alignment;
+	layer_mark_dirty(&text_layer->layer);
+}
+
+/* Centred in the layer, the SDK default */
+static void bitmap_layer_update(Layer *layer, GContext *ctx) {
+	BitmapLayer *bitmap_layer = (BitmapLayer *)layer;
+	GSize size;
+
+	if(bitmap_layer->background_color != GColorClear) {
+		graphics_context_set_fill_color(ctx, bitmap_layer->background_color);
+		graphics_fill_rect(ctx, layer->bounds, 0, GCornerNone);
+	}
+	if(!bitmap_layer->bitmap) return;
+
+	size = bitmap_layer->bitmap->bounds.size;
+	graphics_context_set_compositing_mode(ctx, bitmap_layer->compositing_mode);
+	graphics_draw_bitmap_in_rect(ctx, bitmap_layer->bitmap, GRect((layer->bounds.size.w - size.w) / 2,
+			(layer->bounds.size.h - size.h) / 2, size.w, size.h));
+}
+
+BitmapLayer *bitmap_layer_create(GRect frame) {
+	BitmapLayer *bitmap_layer = host_app_calloc(1, sizeof(BitmapLayer));
+
+	layer_init(&bitmap_layer->layer, frame);
+	bitmap_layer->layer.update_proc = bitmap_layer_update;
+	bitmap_layer->background_color = GColorClear;
+	bitmap_layer->compositing_mode = GCompOpAssign;
+	return bitmap_layer;
+}
+
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer) {
+	if(!bitmap_layer) return;
+
+	layer_remove_from_parent(&bitmap_layer->layer);
+	host_app_free(bitmap_layer);
+}
+
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer) {
+	return (Layer *)&bitmap_layer->layer;
+}
+
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap) {
+	bitmap_layer->bitmap = bitmap;
+	layer_mark_dirty(&bitmap_layer->layer);
+}
+
+void bitmap_layer_set_background_color(BitmapLayer *bitmap_layer, GColor color) {
+	bitmap_layer->background_color = color;
+	layer_mark_dirty(&bitmap_layer->layer);
+}
+
+void bitmap_layer_set_compositing_mode(BitmapLayer *bitmap_layer, GCompOp mode) {
+	bitmap_layer->compositing_mode = mode;
+	layer_mark_dirty(&bitmap_layer->layer);
+}
+
+// Windows
+static GRect window_frame(const Window *window) {
+	return window->fullscreen ? GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT) :
+			GRect(0, STATUS_BAR_HEIGHT, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT - STATUS_BAR_HEIGHT);
+}
+
+Window *window_create(void) {
+	Window *window = host_app_calloc(1, sizeof(Window));
+
+	layer_init(&window->root, window_frame(window));
+	window->root.window = window;
+	window->background_color = GColorWhite;
+	window->click_context = window;
+	return window;
+}
+
+static int8_t window_index(const Window *window) {
+	int8_t i;
+
+	for(i = 0; i < window_count; i++) {
+		if(window_stack[i] == window) return i;
+	}
+	return -1;
+}
+
+void window_destroy(Window *window) {
+	if(!window) return;
+
+	window_stack_remove(window, false);
+	host_app_free(window);
+}
+
+void window_set_click_config_provider(Window *window, ClickConfigProvider click_config_provider) {
+	window_set_click_config_provider_with_context(window, click_config_provider, window);
+}
+
+void window_set_click_config_provider_with_context(Window *window, ClickConfigProvider click_config_provider,
+		void *context) {
+	window->click_config_provider = click_config_provider;
+	window->click_context = context;
+}
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers) {
+	window->handlers = handlers;
+}
+
+Layer *window_get_root_layer(const Window *window) {
+	return (Layer *)&window->root;
+}
+
+void window_set_background_color(Window *window, GColor background_color) {
+	window->background_color = background_color;
+	layer_mark_dirty(&window->root);
+}
+
+void window_set_fullscreen(Window *window, bool enabled) {
+	window->fullscreen = enabled;
+	window->root.frame = window_frame(window);
+	window->root.bounds.size = window->root.frame.size;
+}
+
+bool window_get_fullscreen(const Window *window) {
+	return window->fullscreen;
+}
+
+bool window_is_loaded(Window *window) {
+	return window->loaded;
+}
+
+/* The top window takes the buttons, its provider subscribes them afresh each time */
+static void window_appear(Window *window) {
+	if(window->handlers.appear) window->handlers.appear(window);
+
+	memset(window->single_click, 0, sizeof(window->single_click));
+	memset(window->long_click_down, 0, sizeof(window->long_click_down));
+	memset(window->long_click_up, 0, sizeof(window->long_click_up));
+	click_config_window = window;
+	if(window->click_config_provider) window->click_config_provider(window->click_context);
+	click_config_window = NULL;
+	layer_mark_dirty(&window->root);
+}
+
+void window_stack_push(Window *window, bool animated) {
+	Window *top = window_stack_get_top_window();
+
+	if((window_index(window) >= 0) || (window_count == HOST_WINDOWS)) return;
+
+	if(top && top->handlers.disappear) top->handlers.disappear(top);
+	window_stack[window_count++] = window;
+	if(!window->loaded) {
+		window->loaded = true;
+		if(window->handlers.load) window->handlers.load(window);
+	}
+	window_appear(window);
+}
+
+bool window_stack_remove(Window *window, bool animated) {
+	int8_t index = window_index(window);
+	bool top = (index == window_count - 1);
+
+	if(index < 0) return false;
+
+	if(top && window->handlers.disappear) window->handlers.disappear(window);
+	memmove(&window_stack[index], &window_stack[index + 1], (window_count - index - 1) * sizeof(Window *));
+	window_count--;
+	window->loaded = false;
+	if(window->handlers.unload) window->handlers.unload(window);
+	if(top && window_count) window_appear(window_stack[window_count - 1]);
+	return true;
+}
+
+Window *window_stack_pop(bool animated) {
+	Window *top = window_stack_get_top_window();
+
+	if(top) window_stack_remove(top, animated);
+	return top;
+}
+
+Window *window_stack_get_top_window(void) {
+	return window_count ? window_stack[window_count - 1] : NULL;
+}
+
+void window_single_click_subscribe(ButtonId button_id, ClickHandler handler) {
+	if(click_config_window) click_config_window->single_click[button_id] = handler;
+}
+
+void window_long_click_subscribe(ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler,
+		ClickHandler up_handler) {
+	if(!click_config_window) return;
+
+	click_config_window->long_click_down[button_id] = down_handler;
+	click_config_window->long_click_up[button_id] = up_handler;
+}
+
+/* A long press without a long handler is a click. Back pops the window, the last one exits */
+bool host_button(ButtonId button, bool long_press) {
+	Window *top = window_stack_get_top_window();
+	ClickHandler handler;
+
+	if(!top) return false;
+
+	handler = (long_press && top->long_click_down[button]) ? top->long_click_down[button] : top->single_click[button];
+	if(!handler && (button != BUTTON_ID_BACK)) return false;
+
+	host_event_begin("button");
+	if(handler) {
+		handler(NULL, top->click_context);
+		if(long_press && top->long_click_up[button]) top->long_click_up[button](NULL, top->click_context);
+	} else if(window_count > 1) {
+		window_stack_pop(true);
+	} else {
+		exit_requested = true;
+	}
+	host_event_end();
+	return true;
+}
+
+// Animations
+static void animation_stop(Animation *animation, bool finished) {
+	uint8_t i;
+
+	for(i = 0; (i < animation_count) && (animations[i] != animation); i++);
+	if(i == animation_count) return;
+
+	memmove(&animations[i], &animations[i + 1], (animation_count - i - 1) * sizeof(Animation *));
+	animation_count--;
+	animation->scheduled = false;
+	if(animation->handlers.stopped) animation->handlers.stopped(animation, finished, animation->context);
+	if(animation->implementation && animation->implementation->teardown)
+		animation->implementation->teardown(animation);
+}
+
+Animation *animation_create(void) {
+	Animation *animation = host_app_calloc(1, sizeof(Animation));
+
+	animation->duration_ms = 250;
+	animation->curve = AnimationCurveEaseInOut;
+	return animation;
+}
+
+void animation_destroy(Animation *animation) {
+	if(!animation) return;
+
+	animation_unschedule(animation);
+	host_app_free(animation);
+}
+
+void animation_set_delay(Animation *animation, uint32_t delay_ms) {
+	animation->delay_ms = delay_ms;
+}
+
+void animation_set_duration(Animation *animation, uint32_t duration_ms) {
+	animation->duration_ms = duration_ms;
+}
+
+void animation_set_curve(Animation *animation, AnimationCurve curve) {
+	animation->curve = curve;
+}
+
+void animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context) {
+	animation->handlers = callbacks;
+	animation->context = context;
+}
+
+void *animation_get_context(Animation *animation) {
+	return animation->context;
+}
+
+void animation_set_implementation(Animation *animation, const AnimationImplementation *implementation) {
+	animation->implementation = implementation;
+}
+
+/* Scheduling a running animation restarts it, as on the firmware */
+void animation_schedule(Animation *animation) {
+	if(animation->scheduled) animation_stop(animation, false);
+	if(animation_count == HOST_ANIMATIONS) return;
+
+	if(!animation_count) animation_next = now_ms + ANIMATION_FRAME_MS;
+	animations[animation_count++] = animation;
+	animation->scheduled = true;
+	animation->started = false;
+	animation->start_ms = now_ms + animation->delay_ms;
+	if(animation->implementation && animation->implementation->setup)
+		animation->implementation->setup(animation);
+}
+
+void animation_unschedule(Animation *animation) {
+	if(animation->scheduled) animation_stop(animation, false);
+}
+
+void animation_unschedule_all(void) {
+	while(animation_count)
+		animation_stop(animations[0], false);
+}
+
+bool animation_is_scheduled(Animation *animation) {
+	return animation->scheduled;
+}
+
+static uint32_t animation_curve(AnimationCurve curve, uint32_t t) {
+	uint64_t max = ANIMATION_NORMALIZED_MAX;
+
+	switch(curve) {
+		case AnimationCurveEaseIn:		return t * t / max;
+		case AnimationCurveEaseOut:		return max - (max - t) * (max - t) / max;
+		case AnimationCurveEaseInOut:
+			return (t < max / 2) ? 2 * t * t / max : max - 2 * (max - t) * (max - t) / max;
+		default:						return t;
+	}
+}
+
+/* One frame for every running animation, those that reach their end stop after it */
+static void step_animations(void) {
+	Animation *running[HOST_ANIMATIONS];
+	Animation *animation;
+	uint8_t i, count = animation_count;
+	uint32_t t;
+
+	animation_next = now_ms + ANIMATION_FRAME_MS;
+	memcpy(running, animations, count * sizeof(Animation *));
+
+	host_event_begin("animation");
+	for(i = 0; i < count; i++) {
+		animation = running[i];
+		if(!animation->scheduled || (now_ms < animation->start_ms)) continue;
+
+		if(!animation->started) {
+			animation->started = true;
+			if(animation->handlers.started) animation->handlers.started(animation, animation->context);
+		}
+		t = animation->duration_ms ? MIN((now_ms - animation->start_ms) * ANIMATION_NORMALIZED_MAX /
+				animation->duration_ms, ANIMATION_NORMALIZED_MAX) : ANIMATION_NORMALIZED_MAX;
+		if(animation->implementation && animation->implementation->update)
+			animation->implementation->update(animation, animation_curve(animation->curve, t));
+		if(t == ANIMATION_NORMALIZED_MAX) animation_stop(animation, true);
+	}
+	host_event_end();
+}
+
+static void property_animation_update(Animation *animation, const uint32_t time_normalized) {
+	PropertyAnimation *property_animation = (PropertyAnimation *)animation;
+	GRect from = property_animation->from, to = property_animation->to;
+	int32_t t = time_normalized;
+
+	layer_set_frame(property_animation->subject, GRect(
+			from.origin.x + (to.origin.x - from.origin.x) * t / ANIMATION_NORMALIZED_MAX,
+			from.origin.y + (to.origin.y - from.origin.y) * t / ANIMATION_NORMALIZED_MAX,
+			from.size.w + (to.size.w - from.size.w) * t / ANIMATION_NORMALIZED_MAX,
+			from.size.h + (to.size.h - from.size.h) * t / ANIMATION_NORMALIZED_MAX));
+}
+
+static const AnimationImplementation PROPERTY_ANIMATION = {
+	.update = property_animation_update,
+};
+
+PropertyAnimation *property_animation_create_layer_frame(Layer *layer, GRect *from_frame, GRect *to_frame) {
+	PropertyAnimation *property_animation = host_app_calloc(1, sizeof(PropertyAnimation));
+
+	property_animation->animation.duration_ms = 250;
+	property_animation->animation.curve = AnimationCurveEaseInOut;
+	property_animation->animation.implementation = &PROPERTY_ANIMATION;
+	property_animation->subject = layer;
+	property_animation->from = from_frame ? *from_frame : layer->frame;
+	property_animation->to = to_frame ? *to_frame : layer->frame;
+	return property_animation;
+}
+
+void property_animation_destroy(PropertyAnimation *property_animation) {
+	animation_destroy(&property_animation->animation);
+}
+
+// Rendering
+static void render_layer(Layer *layer, GContext *ctx, GPoint origin, GRect clip) {
+	GPoint at = GPoint(origin.x + layer->frame.origin.x, origin.y + layer->frame.origin.y);
+	int16_t left = MAX(clip.origin.x, at.x), top = MAX(clip.origin.y, at.y);
+	int16_t right = MIN(clip.origin.x + clip.size.w, at.x + layer->frame.size.w);
+	int16_t bottom = MIN(clip.origin.y + clip.size.h, at.y + layer->frame.size.h);
+	Layer *child;
+
+	if(layer->hidden || (right <= left) || (bottom <= top)) return;
+
+	at.x += layer->bounds.origin.x;
+	at.y += layer->bounds.origin.y;
+	clip = GRect(left, top, right - left, bottom - top);
+	if(layer->update_proc) {
+		*ctx = (GContext) {.offset = at, .clip = clip, .stroke_color = GColorBlack, .fill_color = GColorBlack,
+				.text_color = GColorBlack, .compositing_mode = GCompOpAssign};
+		layer->update_proc(layer, ctx);
+	}
+	for(child = layer->first_child; child; child = child->next_sibling)
+		render_layer(child, ctx, at, clip);
+}
+
+/* The whole top window, like the firmware does whatever was marked */
+static void render(void) {
+	Window *top = window_stack_get_top_window();
+	GContext ctx = {.clip = GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT)};
+	uint32_t changed = 0;
+	int x, y;
+
+	memcpy(previous_frame, host_framebuffer, sizeof(previous_frame));
+	memset(host_framebuffer, top->background_color == GColorWhite, sizeof(host_framebuffer));
+	if(!top->fullscreen) memset(host_framebuffer, GColorBlack, STATUS_BAR_HEIGHT * HOST_SCREEN_WIDTH);
+	render_layer(&top->root, &ctx, GPoint(0, 0), ctx.clip);
+	render_pending = false;
+
+	for(y = 0; y < HOST_SCREEN_HEIGHT; y++) {
+		for(x = 0; x < HOST_SCREEN_WIDTH; x++)
+			changed += host_framebuffer[y][x] != previous_frame[y][x];
+	}
+	frame.changed = changed;
+}
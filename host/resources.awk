@@ -0,0 +1,23 @@
+# Turns the media list of appinfo.json into the HOST_RESOURCES X-macro pebble.h expands
+function value(line) {
+	sub(/^[^:]*:[ \t]*"/, "", line)
+	sub(/".*$/, "", line)
+	return line
+}
+
+BEGIN {
+	print "/* Generated from appinfo.json by resources.awk, do not edit */"
+	printf "#define HOST_RESOURCES(X)"
+}
+
+/"type"[ \t]*:/ { type = value($0) }
+/"name"[ \t]*:/ { name = value($0) }
+/"file"[ \t]*:/ { file = value($0) }
+
+/}/ {
+	if(name != "" && file != "")
+		printf " \\\n\tX(%s, \"%s\", \"%s\")", name, type, file
+	name = type = file = ""
+}
+
+END { print "" }
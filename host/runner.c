@@ -0,0 +1,689 @@
+#define _GNU_SOURCE
+#define HOST_INTERNAL
+#include "host.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <libgen.h>
+#include <png.h>
+#include <stdarg.h>
+
+/* Scenario runner for the host build: plays a script of clock moves, phone messages and
+   button presses into the unmodified app, checks frames against PNG goldens and reports
+   what every event cost. See README.md for the script language */
+
+#define app_names host_app_names
+#include "../src/globals.h"
+#undef app_names
+
+#define MAX(a, b) (((a) < (b)) ? (b) : (a))
+
+#define MAX_LINES 1024
+#define MAX_LINE 1024
+#define MAX_TOKENS 32
+#define MAX_SENT 256
+#define MAX_EVENTS 16
+#define MESSAGE_SIZE 2048
+#define MAX_REPLAY_BLOCKS 64
+
+// Recorder layout from record_dict and record_write_blob in sm_watchapp.c
+#define RECORD_VERSION 1
+#define RECORD_BLOCK_SIZE 256
+#define RECORD_HEADER_SIZE 10
+#define RECORD_TUPLE_SIZE 5
+enum {RECORD_START, RECORD_IN, RECORD_SENT, RECORD_FAILED, RECORD_DROPPED};
+
+#define KEY_NAME(name, id, ...) {#name, id},
+static const struct {
+	const char *name;
+	uint32_t key;
+} KEYS[] = {
+	SM_PROTOCOL(KEY_NAME)
+};
+
+typedef struct {
+	const char *event;
+	uint32_t count;
+	uint32_t frames;
+	uint64_t callback_us;
+	uint32_t callback_max;
+	uint64_t render_us;
+	uint64_t draws;
+	uint64_t changed;
+	uint64_t writes;
+} EventTotals;
+
+typedef struct {
+	uint8_t index;
+	uint8_t head;
+	uint16_t length;
+	uint8_t data[RECORD_BLOCK_SIZE];
+} ReplayBlock;
+
+int app_main(void);
+
+static char *lines[MAX_LINES];
+static uint16_t line_numbers[MAX_LINES];
+static uint16_t line_count, line_next;
+static const char *scenario_name, *scenario_dir;
+static const char *golden_dir = "golden";
+static const char *out_dir = ".";
+static bool update_golden, verbose, restart_pending;
+static int failures;
+static uint64_t started;
+
+static uint32_t sent_keys[MAX_SENT];
+static uint16_t sent_count;
+static uint32_t timers_fired;
+
+static EventTotals totals[MAX_EVENTS];
+static uint8_t totals_count;
+
+/* Report times count from launch */
+static double seconds(uint64_t ms) {
+	return (ms - started) / 1000.0;
+}
+
+static void fail(const char *fmt, ...) {
+	va_list args;
+
+	fflush(stdout);
+	fprintf(stderr, "%s:%d: ", scenario_name, line_next ? line_numbers[line_next - 1] : 0);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+	failures++;
+}
+
+static const char *key_name(uint32_t key) {
+	static char unknown[16];
+	size_t i;
+
+	for(i = 0; i < sizeof(KEYS) / sizeof(KEYS[0]); i++) {
+		if(KEYS[i].key == key) return KEYS[i].name;
+	}
+	snprintf(unknown, sizeof(unknown), "0x%X", (unsigned)key);
+	return unknown;
+}
+
+static bool key_parse(const char *name, uint32_t *key) {
+	char *end;
+	size_t i;
+
+	for(i = 0; i < sizeof(KEYS) / sizeof(KEYS[0]); i++) {
+		if(!strcmp(KEYS[i].name, name)) {
+			*key = KEYS[i].key;
+			return true;
+		}
+	}
+	*key = strtoul(name, &end, 0);
+	return *name && !*end;
+}
+
+/* Milliseconds from 250ms, 10s, 5m, 2h or a plain number of seconds */
+static bool duration_parse(const char *text, uint64_t *ms) {
+	char *unit;
+	double value = strtod(text, &unit);
+
+	if((unit == text) || (value < 0)) return false;
+	if(!strcmp(unit, "ms")) *ms = value;
+	else if(!strcmp(unit, "s") || !*unit) *ms = value * 1000;
+	else if(!strcmp(unit, "m")) *ms = value * 60 * 1000;
+	else if(!strcmp(unit, "h")) *ms = value * 60 * 60 * 1000;
+	else return false;
+	return true;
+}
+
+/* Splits on blanks, double quotes keep a value together and understand \" \\ \n */
+static int tokenize(char *line, char **tokens) {
+	char *in = line, *out;
+	int count = 0;
+	bool quoted;
+
+	for(;;) {
+		while(isspace((unsigned char)*in))
+			in++;
+		if(!*in || (*in == '#') || (count == MAX_TOKENS)) break;
+
+		tokens[count++] = out = in;
+		quoted = false;
+		while(*in && (quoted || !isspace((unsigned char)*in))) {
+			if(*in == '"') {
+				quoted = !quoted;
+				*out++ = *in++;
+			} else if(quoted && (*in == '\\') && in[1]) {
+				in++;
+				*out++ = (*in == 'n') ? '\n' : *in;
+				in++;
+			} else {
+				*out++ = *in++;
+			}
+		}
+		if(*in) in++;
+		*out = '\0';
+	}
+	return count;
+}
+
+// Messages
+/* KEY="text", KEY=hex:0102, KEY=u8:1 and friends, or KEY=N for an int32 */
+static bool tuple_write(DictionaryIterator *iter, char *token) {
+	static const struct {
+		const char *prefix;
+		uint8_t width;
+		bool is_signed;
+	} INTS[] = {
+		{"u8:", 1, false}, {"u16:", 2, false}, {"u32:", 4, false},
+		{"i8:", 1, true}, {"i16:", 2, true}, {"i32:", 4, true},
+	};
+	uint8_t data[MESSAGE_SIZE];
+	char *value = strchr(token, '='), *end;
+	uint32_t key;
+	int32_t integer;
+	size_t i, length;
+
+	if(!value) return false;
+	*value++ = '\0';
+	if(!key_parse(token, &key)) return false;
+
+	length = strlen(value);
+	if((length >= 2) && (value[0] == '"') && (value[length - 1] == '"')) {
+		value[length - 1] = '\0';
+		return dict_write_cstring(iter, key, value + 1) == DICT_OK;
+	}
+	if(!strncmp(value, "hex:", 4)) {
+		for(value += 4, length = 0; isxdigit((unsigned char)value[0]) && isxdigit((unsigned char)value[1]);
+				value += 2) {
+			sscanf(value, "%2hhx", &data[length++]);
+		}
+		return !*value && (dict_write_data(iter, key, data, length) == DICT_OK);
+	}
+	for(i = 0; i < sizeof(INTS) / sizeof(INTS[0]); i++) {
+		if(!strncmp(value, INTS[i].prefix, strlen(INTS[i].prefix))) {
+			value += strlen(INTS[i].prefix);
+			break;
+		}
+	}
+	integer = strtol(value, &end, 0);
+	if(!*value || *end) return false;
+	if(i == sizeof(INTS) / sizeof(INTS[0])) return dict_write_int32(iter, key, integer) == DICT_OK;
+	return dict_write_int(iter, key, &integer, INTS[i].width, INTS[i].is_signed) == DICT_OK;
+}
+
+static void tuple_print(const Tuple *t) {
+	uint16_t i;
+
+	printf(" %s=", key_name(t->key));
+	switch(t->type) {
+		case TUPLE_CSTRING:
+			printf("\"%.*s\"", t->length ? t->length - 1 : 0, t->value->cstring);
+			break;
+		case TUPLE_BYTE_ARRAY:
+			printf("hex:");
+			for(i = 0; i < t->length; i++)
+				printf("%02x", t->value->data[i]);
+			break;
+		default:
+			printf("%s%u:", (t->type == TUPLE_INT) ? "i" : "u", t->length * 8);
+			if(t->length == 1) printf("%d", (t->type == TUPLE_INT) ? t->value->int8 : t->value->uint8);
+			else if(t->length == 2) printf("%d", (t->type == TUPLE_INT) ? t->value->int16 : t->value->uint16);
+			else printf("%lld", (t->type == TUPLE_INT) ? (long long)t->value->int32 : (long long)t->value->uint32);
+			break;
+	}
+}
+
+/* What the phone saw, kept for expect-sent */
+static void outbox_seen(const uint8_t *dict, uint16_t size, AppMessageResult result) {
+	DictionaryIterator iter;
+	Tuple *t;
+
+	if(verbose) printf("%10.3f   sent", seconds(host_now_ms()));
+	for(t = dict_read_begin_from_buffer(&iter, dict, size); t; t = dict_read_next(&iter)) {
+		if(sent_count < MAX_SENT) sent_keys[sent_count++] = t->key;
+		if(verbose) tuple_print(t);
+	}
+	if(verbose) printf(result == APP_MSG_OK ? "\n" : " (failed %d)\n", result);
+}
+
+static void log_seen(uint8_t level, const char *file, int line, const char *message) {
+	if(verbose || (level == APP_LOG_LEVEL_ERROR))
+		printf("%10.3f   log %s:%d %s\n", seconds(host_now_ms()), basename((char *)file), line, message);
+}
+
+// Replay
+/* Blocks after the head are the older ones when the ring has wrapped */
+static int replay_block_age(const void *a, const void *b) {
+	const ReplayBlock *x = a, *y = b;
+
+	return ((x->index > x->head) ? x->index : x->index + 256) - ((y->index > y->head) ? y->index : y->index + 256);
+}
+
+/* One exported SM_RECORD_KEY value per line, in hex with or without everything up to hex: */
+static int replay_load(const char *path, ReplayBlock *blocks) {
+	char line[2 * (3 + RECORD_BLOCK_SIZE) + MAX_LINE], *hex;
+	uint8_t blob[3 + RECORD_BLOCK_SIZE];
+	FILE *file = fopen(path, "r");
+	uint16_t length;
+	int count = 0;
+
+	if(!file) {
+		fail("%s: %s", path, strerror(errno));
+		return -1;
+	}
+	while(fgets(line, sizeof(line), file)) {
+		hex = strstr(line, "hex:") ? strstr(line, "hex:") + 4 : line;
+		while(isspace((unsigned char)*hex))
+			hex++;
+		if(!*hex || (*hex == '#')) continue;
+
+		for(length = 0; (length < sizeof(blob)) && isxdigit((unsigned char)hex[0]) && isxdigit((unsigned char)hex[1]);
+				hex += 2) {
+			sscanf(hex, "%2hhx", &blob[length++]);
+		}
+		if((length < 3) || (blob[0] != RECORD_VERSION) || (count == MAX_REPLAY_BLOCKS)) {
+			fail("%s: not a version %d recorder block", path, RECORD_VERSION);
+			count = -1;
+			break;
+		}
+		blocks[count].index = blob[1];
+		blocks[count].head = blob[2];
+		blocks[count].length = length - 3;
+		memcpy(blocks[count++].data, blob + 3, length - 3);
+	}
+	fclose(file);
+	if(count > 0) qsort(blocks, count, sizeof(blocks[0]), replay_block_age);
+	return count;
+}
+
+/* Rebuilds an inbound record into the message the watch got, false if a value was cut short */
+static bool replay_deliver(const uint8_t *record) {
+	uint8_t message[MESSAGE_SIZE];
+	DictionaryIterator iter;
+	const uint8_t *p = record + RECORD_HEADER_SIZE;
+	DictionaryResult result = DICT_OK;
+	uint16_t length;
+	uint32_t key;
+	uint8_t i;
+
+	dict_write_begin(&iter, message, sizeof(message));
+	for(i = 0; i < record[RECORD_HEADER_SIZE - 1]; i++, p += RECORD_TUPLE_SIZE + p[4]) {
+		key = SM_KEY_BASE + p[0];
+		length = p[2] | (p[3] << 8);
+		if(p[4] < length) return false;
+
+		switch(p[1]) {
+			case TUPLE_CSTRING:		result = dict_write_cstring(&iter, key, (const char *)(p + RECORD_TUPLE_SIZE)); break;
+			case TUPLE_BYTE_ARRAY:	result = dict_write_data(&iter, key, p + RECORD_TUPLE_SIZE, length); break;
+			default:				result = dict_write_int(&iter, key, p + RECORD_TUPLE_SIZE, length, p[1] == TUPLE_INT); break;
+		}
+		if(result != DICT_OK) return false;
+	}
+	host_deliver(message, dict_write_end(&iter));
+	return true;
+}
+
+/* Inbound messages and drops go to the app as far apart as they were recorded, what the app
+   sent back is its own business this time. Each launch in the recording restarts the pacing */
+static void replay(const char *name) {
+	static ReplayBlock blocks[MAX_REPLAY_BLOCKS];
+	char path[512];
+	const uint8_t *p;
+	uint32_t time, last = 0, messages = 0, drops = 0, skipped = 0;
+	uint16_t offset, length;
+	bool paced = false;
+	int count, i;
+
+	snprintf(path, sizeof(path), "%s/%s", scenario_dir, name);
+	if((count = replay_load(path, blocks)) < 0) return;
+	if(!bluetooth_connection_service_peek()) {
+		fail("replay while bluetooth is off");
+		return;
+	}
+
+	for(i = 0; i < count; i++) {
+		for(offset = 0; offset + RECORD_HEADER_SIZE <= blocks[i].length; offset += length) {
+			p = blocks[i].data + offset;
+			length = p[0] | (p[1] << 8);
+			if((length < RECORD_HEADER_SIZE) || (offset + length > blocks[i].length)) {
+				fail("%s: block %d is cut short at %d", path, blocks[i].index, offset);
+				break;
+			}
+			if(p[6] == RECORD_START) paced = false;
+			if((p[6] != RECORD_IN) && (p[6] != RECORD_DROPPED)) continue;
+
+			time = p[2] | (p[3] << 8) | (p[4] << 16) | ((uint32_t)p[5] << 24);
+			if(paced && (time > last)) host_advance(time - last);
+			paced = true;
+			last = time;
+
+			if(p[6] == RECORD_DROPPED) {
+				host_drop(p[7] | (p[8] << 8));
+				drops++;
+			} else if(replay_deliver(p)) {
+				messages++;
+			} else {
+				skipped++;
+			}
+		}
+	}
+	printf("%10.3f   replay %s: %u messages, %u drops, %u without whole values\n", seconds(host_now_ms()), name,
+			messages, drops, skipped);
+}
+
+// Frames
+static void frame_seen(const HostFrameStats *stats) {
+	EventTotals *event;
+	uint8_t i;
+
+	for(i = 0; (i < totals_count) && strcmp(totals[i].event, stats->event); i++);
+	if(i == totals_count) {
+		if(totals_count == MAX_EVENTS) return;
+		totals[totals_count++].event = stats->event;
+	}
+	event = &totals[i];
+	event->count++;
+	if(!strcmp(stats->event, "timer")) timers_fired++;
+	event->callback_us += stats->callback_us;
+	event->callback_max = MAX(event->callback_max, stats->callback_us);
+	if(stats->rendered) {
+		event->frames++;
+		event->render_us += stats->render_us;
+		event->draws += stats->draws;
+		event->changed += stats->changed;
+		event->writes += stats->writes;
+	}
+
+	printf("%10.3f %-9s cb %6uus", seconds(stats->time), stats->event, stats->callback_us);
+	if(stats->rendered)
+		printf("  render %6uus  draws %3u  marks %3u  changed %5upx  writes %5upx", stats->render_us, stats->draws,
+				stats->marks, stats->changed, stats->writes);
+	printf("  heap %zu\n", stats->heap_used);
+}
+
+static void totals_print(void) {
+	uint8_t i;
+
+	printf("\n%-9s %6s %6s %12s %8s %12s %8s %10s %10s\n", "event", "count", "frames", "callback us", "max us",
+			"render us", "draws", "changed px", "writes px");
+	for(i = 0; i < totals_count; i++) {
+		printf("%-9s %6u %6u %12llu %8u %12llu %8llu %10llu %10llu\n", totals[i].event, totals[i].count,
+				totals[i].frames, (unsigned long long)totals[i].callback_us, totals[i].callback_max,
+				(unsigned long long)totals[i].render_us, (unsigned long long)totals[i].draws,
+				(unsigned long long)totals[i].changed, (unsigned long long)totals[i].writes);
+	}
+	printf("heap peak %zu bytes, %u blocks left after exit, persist %u bytes, %u vibes\n", host_heap_peak(),
+			host_heap_blocks(), host_persist_bytes(), host_vibes());
+}
+
+static bool png_save(const char *path, const uint8_t *pixels) {
+	png_image image;
+	uint8_t gray[HOST_SCREEN_WIDTH * HOST_SCREEN_HEIGHT];
+	int i;
+
+	for(i = 0; i < HOST_SCREEN_WIDTH * HOST_SCREEN_HEIGHT; i++)
+		gray[i] = pixels[i] ? 0xff : 0x00;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	image.width = HOST_SCREEN_WIDTH;
+	image.height = HOST_SCREEN_HEIGHT;
+	image.format = PNG_FORMAT_GRAY;
+	return png_image_write_to_file(&image, path, 0, gray, 0, NULL);
+}
+
+static bool png_load(const char *path, uint8_t *pixels) {
+	png_image image;
+	uint8_t gray[HOST_SCREEN_WIDTH * HOST_SCREEN_HEIGHT];
+	int i;
+
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if(!png_image_begin_read_from_file(&image, path)) return false;
+	if((image.width != HOST_SCREEN_WIDTH) || (image.height != HOST_SCREEN_HEIGHT)) {
+		png_image_free(&image);
+		return false;
+	}
+	image.format = PNG_FORMAT_GRAY;
+	if(!png_image_finish_read(&image, NULL, gray, 0, NULL)) return false;
+
+	for(i = 0; i < HOST_SCREEN_WIDTH * HOST_SCREEN_HEIGHT; i++)
+		pixels[i] = gray[i] >= 128;
+	return true;
+}
+
+/* The screen as it is now against the golden, the actual frame is kept next to the build when they differ */
+static void frame_check(const char *name) {
+	uint8_t golden[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH];
+	char golden_path[512], actual_path[512];
+	uint32_t different = 0;
+	int x, y;
+
+	snprintf(golden_path, sizeof(golden_path), "%s/%s-%s.png", golden_dir, scenario_name, name);
+	snprintf(actual_path, sizeof(actual_path), "%s/%s-%s.actual.png", out_dir, scenario_name, name);
+	if(update_golden) {
+		if(!png_save(golden_path, &host_framebuffer[0][0])) fail("cannot write %s", golden_path);
+		return;
+	}
+
+	if(!png_load(golden_path, &golden[0][0])) {
+		png_save(actual_path, &host_framebuffer[0][0]);
+		fail("frame %s: no golden %s, the frame is in %s", name, golden_path, actual_path);
+		return;
+	}
+	for(y = 0; y < HOST_SCREEN_HEIGHT; y++) {
+		for(x = 0; x < HOST_SCREEN_WIDTH; x++)
+			different += golden[y][x] != host_framebuffer[y][x];
+	}
+	if(different) {
+		png_save(actual_path, &host_framebuffer[0][0]);
+		fail("frame %s: %u pixels differ from %s, the frame is in %s", name, different, golden_path, actual_path);
+	} else if(verbose) {
+		printf("%10.3f   frame %s matches\n", seconds(host_now_ms()), name);
+	}
+}
+
+/* Moves the clock like wait, failing if KEY is sent meanwhile or, without one, if a timer wakes the app */
+static void quiet(uint64_t ms, const char *name) {
+	uint32_t key = 0, timers = timers_fired;
+	uint64_t from = host_now_ms();
+	uint16_t i, sent = sent_count;
+
+	if(name && !key_parse(name, &key)) {
+		fail("no key %s", name);
+		return;
+	}
+	host_advance(ms);
+	if(!name) {
+		if(timers_fired != timers) fail("%u timers fired after %.3f", timers_fired - timers, seconds(from));
+		return;
+	}
+	for(i = sent; (i < sent_count) && (sent_keys[i] != key); i++);
+	if(i < sent_count) fail("%s was sent after %.3f", name, seconds(from));
+}
+
+// Commands
+static bool on_off(const char *text, bool *value) {
+	if(!strcmp(text, "on")) *value = true;
+	else if(!strcmp(text, "off")) *value = false;
+	else return false;
+	return true;
+}
+
+/* Commands that describe the watch before launch, and that still work after it */
+static bool setup_command(int argc, char **argv) {
+	static const char *PHONE_MODES[] = {"ack", "nack", "timeout"};
+	static const char *ACCEL_MODES[] = {"off", "still", "walk", "run"};
+	struct tm date;
+	bool flag;
+	uint64_t latency = 50;
+	int i;
+
+	if(!strcmp(argv[0], "bluetooth") && (argc == 2) && on_off(argv[1], &flag)) {
+		host_set_bluetooth(flag);
+	} else if(!strcmp(argv[0], "battery") && (argc >= 2)) {
+		host_set_battery(atoi(argv[1]), (argc > 2) && !strcmp(argv[2], "charging"),
+				(argc > 2) && (!strcmp(argv[2], "charging") || !strcmp(argv[2], "plugged")));
+	} else if(!strcmp(argv[0], "clock-24h") && (argc == 2) && on_off(argv[1], &flag)) {
+		host_set_clock_24h(flag);
+	} else if(!strcmp(argv[0], "phone") && (argc >= 2)) {
+		for(i = 0; (i < 3) && strcmp(argv[1], PHONE_MODES[i]); i++);
+		if((i == 3) || ((argc > 2) && !duration_parse(argv[2], &latency))) return false;
+		host_set_phone(i, latency);
+	} else if(!strcmp(argv[0], "accel") && (argc == 2)) {
+		for(i = 0; (i < 4) && strcmp(argv[1], ACCEL_MODES[i]); i++);
+		if(i == 4) return false;
+		host_set_accel(i);
+	} else if(!strcmp(argv[0], "clock") && (argc == 3)) {
+		memset(&date, 0, sizeof(date));
+		if(!strptime(argv[1], "%Y-%m-%d", &date) || !strptime(argv[2], "%H:%M:%S", &date)) return false;
+		host_set_clock(timegm(&date));
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static void command(int argc, char **argv) {
+	static const char *BUTTONS[] = {"back", "up", "select", "down"};
+	uint8_t message[MESSAGE_SIZE];
+	DictionaryIterator iter;
+	uint32_t key;
+	uint64_t ms;
+	uint16_t i;
+	int arg;
+
+	if(!strcmp(argv[0], "clock")) {
+		fail("clock only goes before the first command that runs the app");
+	} else if(setup_command(argc, argv)) {
+	} else if(!strcmp(argv[0], "wait") && (argc == 2) && duration_parse(argv[1], &ms)) {
+		host_advance(ms);
+	} else if(!strcmp(argv[0], "quiet") && (argc >= 2) && (argc <= 3) && duration_parse(argv[1], &ms)) {
+		quiet(ms, (argc == 3) ? argv[2] : NULL);
+	} else if(!strcmp(argv[0], "msg") && (argc >= 2)) {
+		dict_write_begin(&iter, message, sizeof(message));
+		for(arg = 1; arg < argc; arg++) {
+			if(!tuple_write(&iter, argv[arg])) {
+				fail("bad tuple %s", argv[arg]);
+				return;
+			}
+		}
+		if(!bluetooth_connection_service_peek()) fail("msg while bluetooth is off");
+		else host_deliver(message, dict_write_end(&iter));
+	} else if(!strcmp(argv[0], "drop") && (argc == 2)) {
+		host_drop(!strcmp(argv[1], "overflow") ? APP_MSG_BUFFER_OVERFLOW : APP_MSG_BUSY);
+	} else if(!strcmp(argv[0], "tap") && (argc <= 3)) {
+		// tap [x|y|z] [1|-1], a flick along z by default
+		host_tap((argc > 1) ? (argv[1][0] == 'x') ? ACCEL_AXIS_X : (argv[1][0] == 'y') ? ACCEL_AXIS_Y : ACCEL_AXIS_Z :
+				ACCEL_AXIS_Z, (argc > 2) ? atoi(argv[2]) : 1);
+	} else if(!strcmp(argv[0], "button") && (argc >= 2)) {
+		for(i = 0; (i < NUM_BUTTONS) && strcmp(argv[1], BUTTONS[i]); i++);
+		if(i == NUM_BUTTONS) fail("no button %s", argv[1]);
+		else host_button(i, (argc > 2) && !strcmp(argv[2], "long"));
+	} else if(!strcmp(argv[0], "replay") && (argc == 2)) {
+		replay(argv[1]);
+	} else if(!strcmp(argv[0], "frame") && (argc == 2)) {
+		frame_check(argv[1]);
+	} else if(!strcmp(argv[0], "expect-sent") && (argc == 2) && key_parse(argv[1], &key)) {
+		for(i = 0; (i < sent_count) && (sent_keys[i] != key); i++);
+		if(i == sent_count) fail("%s was not sent", argv[1]);
+		sent_count = 0;
+	} else if(!strcmp(argv[0], "clear-sent") && (argc == 1)) {
+		sent_count = 0;
+	} else {
+		fail("bad command %s", argv[0]);
+	}
+}
+
+/* Runs from app_event_loop until the script ends, asks for a restart or the app exits */
+static void scenario_loop(void) {
+	char *argv[MAX_TOKENS];
+	int argc;
+
+	while(line_next < line_count) {
+		argc = tokenize(lines[line_next++], argv);
+		if(!argc) continue;
+
+		if(!strcmp(argv[0], "restart") && (argc == 1)) {
+			restart_pending = true;
+			return;
+		}
+		if(!strcmp(argv[0], "exit") && (argc == 1)) return;
+		command(argc, argv);
+		if(host_exit_requested()) return;
+	}
+}
+
+static bool scenario_load(const char *path) {
+	static char text[MAX_LINES * MAX_LINE];
+	FILE *file = fopen(path, "r");
+	char *p = text, *dot;
+	uint16_t number = 0;
+
+	if(!file) return false;
+	while((line_count < MAX_LINES) && fgets(p, MAX_LINE, file)) {
+		number++;
+		p[strcspn(p, "\r\n")] = '\0';
+		line_numbers[line_count] = number;
+		lines[line_count++] = p;
+		p += strlen(p) + 1;
+	}
+	fclose(file);
+
+	scenario_dir = dirname(strdup(path));
+	scenario_name = basename(strdup(path));
+	if((dot = strrchr(scenario_name, '.'))) *dot = '\0';
+	return true;
+}
+
+static int usage(void) {
+	fprintf(stderr, "usage: runner [-v] [--update] [--golden DIR] [--out DIR] [--resources DIR] SCENARIO\n");
+	return 2;
+}
+
+int main(int argc, char **argv) {
+	char copy[MAX_LINE], *tokens[MAX_TOKENS];
+	int arg, count;
+
+	for(arg = 1; (arg < argc) && (argv[arg][0] == '-'); arg++) {
+		if(!strcmp(argv[arg], "-v")) verbose = true;
+		else if(!strcmp(argv[arg], "--update")) update_golden = true;
+		else if(!strcmp(argv[arg], "--golden") && (arg + 1 < argc)) golden_dir = argv[++arg];
+		else if(!strcmp(argv[arg], "--out") && (arg + 1 < argc)) out_dir = argv[++arg];
+		else if(!strcmp(argv[arg], "--resources") && (arg + 1 < argc)) host_set_resource_dir(argv[++arg]);
+		else return usage();
+	}
+	if(arg + 1 != argc) return usage();
+	if(!scenario_load(argv[arg])) {
+		fprintf(stderr, "%s: %s\n", argv[arg], strerror(errno));
+		return 2;
+	}
+
+	// Frames only compare if every run sees the same local time
+	setenv("TZ", "UTC", 1);
+	tzset();
+	host_set_clock(1401699600);
+	host_set_frame_handler(frame_seen);
+	host_set_outbox_handler(outbox_seen);
+	host_set_log_handler(log_seen);
+	host_set_loop(scenario_loop);
+
+	// Setup lines up to the first one that needs the app
+	while(line_next < line_count) {
+		snprintf(copy, sizeof(copy), "%s", lines[line_next]);
+		count = tokenize(copy, tokens);
+		if(count && !setup_command(count, tokens)) break;
+		line_next++;
+	}
+
+	started = host_now_ms();
+	do {
+		restart_pending = false;
+		host_event_begin("launch");
+		app_main();
+		host_event_end();
+	} while(restart_pending);
+
+	if(line_next < line_count) fail("the app exited before the end of the scenario");
+	totals_print();
+	return failures ? 1 : 0;
+}
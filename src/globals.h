@@ -1,81 +1,106 @@
 #ifndef _globals_h
 #define _globals_h
 
-#define SM_RECONNECT_KEY 			0xFC01
-#define SM_SEQUENCE_NUMBER_KEY 		0xFC02
-#define SM_OPEN_SIRI_KEY	 		0xFC03
-#define SM_STATUS_SCREEN_REQ_KEY	0xFC04
-#define SM_PLAYPAUSE_KEY			0xFC05
-#define SM_NEXT_TRACK_KEY			0xFC06
-#define SM_PREVIOUS_TRACK_KEY		0xFC07
-#define SM_VOLUME_UP_KEY			0xFC08
-#define SM_VOLUME_DOWN_KEY			0xFC09
-#define SM_COUNT_MAIL_KEY			0xFC0A
-#define SM_COUNT_SMS_KEY			0xFC0B
-#define SM_COUNT_PHONE_KEY			0xFC0C
-#define SM_COUNT_BATTERY_KEY		0xFC0D
-#define SM_SCREEN_ENTER_KEY			0xFC0E
-#define SM_SCREEN_EXIT_KEY			0xFC0F
-#define SM_WEATHER_COND_KEY			0xFC10
-#define SM_WEATHER_TEMP_KEY			0xFC11
-#define SM_WEATHER_ICON_KEY			0xFC12
-#define SM_STATUS_SCREEN_UPDATE_KEY	0xFC13
-#define SM_VOLUME_VALUE_KEY			0xFC14
-#define SM_PLAY_STATUS_KEY			0xFC15
-#define SM_ARTIST_KEY               0xFC16
-#define SM_ALBUM_KEY                0xFC17
-#define SM_TITLE_KEY                0xFC18
-#define SM_WEATHER_HUMID_KEY		0xFC19
-#define SM_WEATHER_WIND_KEY			0xFC1A
-#define SM_WEATHER_DAY1_KEY			0xFC1B
-#define SM_WEATHER_DAY2_KEY			0xFC1C
-#define SM_WEATHER_DAY3_KEY			0xFC1D
-#define SM_WEATHER_ICON1_KEY		0xFC1E
-#define SM_WEATHER_ICON2_KEY		0xFC1F
-#define SM_WEATHER_ICON3_KEY		0xFC20
-#define SM_CALENDAR_UPDATE_KEY		0xFC21
-#define SM_MENU_UPDATE_KEY			0xFC22
-#define SM_STOCKS_GRAPH_KEY			0xFC23
-#define SM_BITCOIN_GRAPH_KEY		0xFC24
-#define SM_BITCOIN_LOW_KEY			0xFC25
-#define SM_BITCOIN_HIGH_KEY			0xFC26
-#define SM_BITCOIN_CURR_KEY			0xFC27
-#define SM_BITCOIN_TITLE_KEY		0xFC28
-#define SM_STOCKS_LOW_KEY			0xFC29
-#define SM_STOCKS_HIGH_KEY			0xFC2A
-#define SM_STOCKS_CURR_KEY			0xFC2B
-#define SM_STOCKS_TITLE_KEY			0xFC2C
-#define SM_LAUNCH_CAMERA_KEY		0xFC2D
-#define SM_TAKE_PICTURE_KEY			0xFC2E
-#define SM_URL1_KEY					0xFC2F
-#define SM_URL2_KEY					0xFC30
-#define SM_URL1_TEXT_KEY			0xFC31
-#define SM_URL2_TEXT_KEY			0xFC32
-#define SM_GPS_1_KEY				0xFC33
-#define SM_GPS_2_KEY				0xFC34
-#define SM_GPS_3_KEY				0xFC35
-#define SM_GPS_4_KEY				0xFC36
-#define SM_RESET_DST_KEY			0xFC37
-#define SM_MESSAGES_UPDATE_KEY		0xFC38
-#define SM_CALLS_UPDATE_KEY			0xFC38
-#define SM_CAL_DETAILS_KEY			0xFC39
-#define SM_DETAILS1_KEY				0xFC3A
-#define SM_DETAILS2_KEY				0xFC3B
-#define SM_CALL_SMS_KEY				0xFC3C
-#define SM_CALL_SMS_UPDATE_KEY		0xFC3D
-#define SM_CALL_SMS_CMD_KEY			0xFC3E
-#define SM_SMS_SENT_KEY             0xFC3F
-#define SM_FIND_MY_PHONE_KEY        0xFC40
-#define SM_REMINDERS_KEY 	       	0xFC41
-#define SM_REMINDERS_DETAILS_KEY    0xFC42
-#define SM_STATUS_CAL_TIME_KEY   	0xFC43
-#define SM_STATUS_CAL_TEXT_KEY   	0xFC44
-#define SM_STATUS_MUS_ARTIST_KEY	0xFC45
-#define SM_STATUS_MUS_TITLE_KEY		0xFC46
-#define SM_UPDATE_INTERVAL_KEY		0xFC47
-#define SM_SONG_LENGTH_KEY          0xFC48
-#define SM_STATUS_UPD_WEATHER_KEY   0xFC49
-#define SM_STATUS_UPD_CAL_KEY       0xFC4A
+/* The whole phone protocol, one row per key:
+   X(name, id, inbound tuple types, inbound min length, inbound max length, outbound max length, refresh batch, handler)
+   A zero max length means the watch never gets, or never sends, that key. Lengths are value bytes, strings
+   count their NUL, and may use the app's own limits since the table is only expanded in sm_watchapp.c.
+   A longer string is still taken and cut to its slot, the max only sizes the inbox for it.
+   Keys with zeros everywhere belong to the other SmartStatus apps, they only keep their ids taken */
+#define SM_PROTOCOL(X) \
+	X(SM_RECONNECT_KEY,				0xFC01,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_SEQUENCE_NUMBER_KEY,		0xFC02,	RCV_TYPE_INT,		1,						4,							4,					0,	NULL) \
+	X(SM_OPEN_SIRI_KEY,				0xFC03,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_STATUS_SCREEN_REQ_KEY,		0xFC04,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_PLAYPAUSE_KEY,				0xFC05,	0,					0,						0,							1,					0,	NULL) \
+	X(SM_NEXT_TRACK_KEY,			0xFC06,	0,					0,						0,							1,					0,	NULL) \
+	X(SM_PREVIOUS_TRACK_KEY,		0xFC07,	0,					0,						0,							1,					0,	NULL) \
+	X(SM_VOLUME_UP_KEY,				0xFC08,	0,					0,						0,							1,					0,	NULL) \
+	X(SM_VOLUME_DOWN_KEY,			0xFC09,	0,					0,						0,							1,					0,	NULL) \
+	X(SM_COUNT_MAIL_KEY,			0xFC0A,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_COUNT_SMS_KEY,				0xFC0B,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_COUNT_PHONE_KEY,			0xFC0C,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_COUNT_BATTERY_KEY,			0xFC0D,	RCV_TYPE_INT,		1,						4,							0,					0,	rcv_phone_battery) \
+	X(SM_SCREEN_ENTER_KEY,			0xFC0E,	0,					0,						0,							1,					1,	NULL) \
+	X(SM_SCREEN_EXIT_KEY,			0xFC0F,	0,					0,						0,							1,					0,	NULL) \
+	X(SM_WEATHER_COND_KEY,			0xFC10,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_WEATHER_TEMP_KEY,			0xFC11,	RCV_TYPE_CSTRING,	1,						TEXT_TEMP_LENGTH + 1,		0,					0,	rcv_weather_temp) \
+	X(SM_WEATHER_ICON_KEY,			0xFC12,	RCV_TYPE_INT,		1,						4,							0,					0,	rcv_weather_icon) \
+	X(SM_STATUS_SCREEN_UPDATE_KEY,	0xFC13,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_VOLUME_VALUE_KEY,			0xFC14,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_PLAY_STATUS_KEY,			0xFC15,	RCV_TYPE_DATA,		MUSIC_PROGRESS_SIZE,	MUSIC_PROGRESS_SIZE,		0,					0,	rcv_play_status) \
+	X(SM_ARTIST_KEY,				0xFC16,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_ALBUM_KEY,					0xFC17,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_TITLE_KEY,					0xFC18,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_WEATHER_HUMID_KEY,			0xFC19,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_WEATHER_WIND_KEY,			0xFC1A,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_WEATHER_DAY1_KEY,			0xFC1B,	RCV_TYPE_CSTRING,	7,						6 + TEXT_TEMP_LENGTH + 1,	0,					0,	rcv_weather_day1) \
+	X(SM_WEATHER_DAY2_KEY,			0xFC1C,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_WEATHER_DAY3_KEY,			0xFC1D,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_WEATHER_ICON1_KEY,			0xFC1E,	RCV_TYPE_INT,		1,						4,							0,					0,	rcv_weather_icon1) \
+	X(SM_WEATHER_ICON2_KEY,			0xFC1F,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_WEATHER_ICON3_KEY,			0xFC20,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_CALENDAR_UPDATE_KEY,		0xFC21,	RCV_TYPE_INT,		1,						4,							0,					0,	rcv_cal_changed) \
+	X(SM_MENU_UPDATE_KEY,			0xFC22,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_STOCKS_GRAPH_KEY,			0xFC23,	RCV_TYPE_DATA,		SPARK_HEADER_SIZE,		SPARK_UPDATE_SIZE,			1,					0,	rcv_spark) \
+	X(SM_BITCOIN_GRAPH_KEY,			0xFC24,	RCV_TYPE_DATA,		SPARK_HEADER_SIZE,		SPARK_UPDATE_SIZE,			1,					0,	rcv_spark) \
+	X(SM_BITCOIN_LOW_KEY,			0xFC25,	RCV_TYPE_CSTRING,	1,						TEXT_QUOTE_LENGTH + 1,		0,					0,	rcv_quote) \
+	X(SM_BITCOIN_HIGH_KEY,			0xFC26,	RCV_TYPE_CSTRING,	1,						TEXT_QUOTE_LENGTH + 1,		0,					0,	rcv_quote) \
+	X(SM_BITCOIN_CURR_KEY,			0xFC27,	RCV_TYPE_CSTRING,	1,						TEXT_QUOTE_LENGTH + 1,		0,					0,	rcv_quote) \
+	X(SM_BITCOIN_TITLE_KEY,			0xFC28,	RCV_TYPE_CSTRING,	1,						TEXT_TITLE_LENGTH + 1,		0,					0,	rcv_quote) \
+	X(SM_STOCKS_LOW_KEY,			0xFC29,	RCV_TYPE_CSTRING,	1,						TEXT_QUOTE_LENGTH + 1,		0,					0,	rcv_quote) \
+	X(SM_STOCKS_HIGH_KEY,			0xFC2A,	RCV_TYPE_CSTRING,	1,						TEXT_QUOTE_LENGTH + 1,		0,					0,	rcv_quote) \
+	X(SM_STOCKS_CURR_KEY,			0xFC2B,	RCV_TYPE_CSTRING,	1,						TEXT_QUOTE_LENGTH + 1,		0,					0,	rcv_quote) \
+	X(SM_STOCKS_TITLE_KEY,			0xFC2C,	RCV_TYPE_CSTRING,	1,						TEXT_TITLE_LENGTH + 1,		0,					0,	rcv_quote) \
+	X(SM_LAUNCH_CAMERA_KEY,			0xFC2D,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_TAKE_PICTURE_KEY,			0xFC2E,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_URL1_KEY,					0xFC2F,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_URL2_KEY,					0xFC30,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_URL1_TEXT_KEY,				0xFC31,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_URL2_TEXT_KEY,				0xFC32,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_GPS_1_KEY,					0xFC33,	RCV_TYPE_CSTRING,	1,						TEXT_LINE_LENGTH + 1,		0,					0,	rcv_gps_1) \
+	X(SM_GPS_2_KEY,					0xFC34,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_GPS_3_KEY,					0xFC35,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_GPS_4_KEY,					0xFC36,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_RESET_DST_KEY,				0xFC37,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_MESSAGES_UPDATE_KEY,		0xFC38,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_CAL_DETAILS_KEY,			0xFC39,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_DETAILS1_KEY,				0xFC3A,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_DETAILS2_KEY,				0xFC3B,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_CALL_SMS_KEY,				0xFC3C,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_CALL_SMS_UPDATE_KEY,		0xFC3D,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_CALL_SMS_CMD_KEY,			0xFC3E,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_SMS_SENT_KEY,				0xFC3F,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_FIND_MY_PHONE_KEY,			0xFC40,	0,					0,						0,							1,					0,	NULL) \
+	X(SM_REMINDERS_KEY,				0xFC41,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_REMINDERS_DETAILS_KEY,		0xFC42,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_STATUS_CAL_TIME_KEY,		0xFC43,	RCV_TYPE_CSTRING,	1,						TEXT_DATE_LENGTH + 1,		0,					0,	rcv_cal_time) \
+	X(SM_STATUS_CAL_TEXT_KEY,		0xFC44,	RCV_TYPE_CSTRING,	1,						TEXT_LINE_LENGTH + 1,		0,					0,	rcv_cal_text) \
+	X(SM_STATUS_MUS_ARTIST_KEY,		0xFC45,	RCV_TYPE_CSTRING,	1,						TEXT_LINE_LENGTH + 1,		0,					0,	rcv_music_artist) \
+	X(SM_STATUS_MUS_TITLE_KEY,		0xFC46,	RCV_TYPE_CSTRING,	1,						TEXT_LINE_LENGTH + 1,		0,					0,	rcv_music_title) \
+	X(SM_UPDATE_INTERVAL_KEY,		0xFC47,	RCV_TYPE_INT,		1,						4,							0,					0,	rcv_update_interval) \
+	X(SM_SONG_LENGTH_KEY,			0xFC48,	RCV_TYPE_INT,		1,						4,							1,					1,	rcv_song_length) \
+	X(SM_STATUS_UPD_WEATHER_KEY,	0xFC49,	RCV_TYPE_INT,		1,						4,							1,					1,	rcv_weather_interval) \
+	X(SM_STATUS_UPD_CAL_KEY,		0xFC4A,	RCV_TYPE_INT,		1,						4,							1,					1,	rcv_calendar_interval) \
+	X(SM_REFRESH_BATCH_KEY,			0xFC4B,	RCV_TYPE_INT,		1,						4,							1,					1,	rcv_refresh_batch) \
+	X(SM_QUIET_HOURS_KEY,			0xFC4C,	RCV_TYPE_INT,		2,						4,							0,					0,	rcv_quiet_hours) \
+	X(SM_LINK_STATS_KEY,			0xFC4D,	RCV_TYPE_INT,		1,						4,							LINK_BLOB_SIZE,		0,	rcv_link_stats) \
+	X(SM_TRACE_DUMP_KEY,			0xFC4E,	RCV_TYPE_INT,		1,						4,							TRACE_BLOB_SIZE,	0,	rcv_trace_dump) \
+	X(SM_CAL_QUEUE_KEY,				0xFC4F,	RCV_TYPE_DATA,		2,						CAL_QUEUE_BLOB_SIZE,		1,					1,	rcv_cal_queue) \
+	X(SM_WEATHER_DATA_KEY,			0xFC50,	RCV_TYPE_DATA,		WEATHER_HEADER_SIZE,	WEATHER_BLOB_SIZE,			1,					1,	rcv_weather_data) \
+	X(SM_SUBSCRIBE_KEY,				0xFC51,	RCV_TYPE_INT,		1,						4,							SUB_BLOB_SIZE,		0,	rcv_subscribe) \
+	X(SM_CALLS_UPDATE_KEY,			0xFC52,	0,					0,						0,							0,					0,	NULL) \
+	X(SM_RECORD_KEY,				0xFC53,	RCV_TYPE_INT,		1,						4,							RECORD_BLOB_SIZE,	0,	rcv_record) \
+	X(SM_TOPIC_SYNC_KEY,			0xFC54,	RCV_TYPE_DATA,		3,						SYNC_BLOB_SIZE,				SYNC_BLOB_SIZE,		0,	rcv_topic_sync)
+
+#define SM_KEY_ENUM(name, id, ...)	name = (id),
+typedef enum {SM_PROTOCOL(SM_KEY_ENUM)} SmKeys;
+
+/* Every key lives in SM_KEY_BASE + 1 .. SM_KEY_BASE + SM_NUM_KEYS - 1, the span follows the highest id */
+#define SM_KEY_BASE					0xFC00
+#define SM_KEY_SPAN(name, id, ...)	char span_##name[(id) - SM_KEY_BASE + 1];
+typedef union {SM_PROTOCOL(SM_KEY_SPAN)} SmKeySpan;
+#define SM_NUM_KEYS					sizeof(SmKeySpan)
 
 
 
@@ -3,33 +3,515 @@
 #include "globals.h"
 
 #define DEBUG 0
+#define PROFILE 0
+
+/* Trace records kept: 0 none and no ring built at all, 1 link events, 2 scheduled jobs,
+   3 every command and tuple */
+#define TRACE_LEVEL 1
+#define TRACE_LINK 1
+#define TRACE_JOBS 2
+#define TRACE_VERBOSE 3
+#define TRACE_RING_SIZE 32
+#define TRACE_DUMP_VERSION 1
+#define TRACE_BLOB_SIZE ((TRACE_LEVEL > 0) ? 2 + TRACE_RING_SIZE * sizeof(TraceRecord) : 0)
+#define BATCHED_REFRESH 1
+
+/* Traffic recorder: 0 off, 1 keys, types and lengths of every message, 2 also the first
+   RECORD_PAYLOAD_BYTES of each value, which is what the host build's replay needs */
+#define RECORD_LEVEL 0
+#define RECORD_BLOCKS 8
+#define RECORD_BLOCK_SIZE PERSIST_DATA_MAX_LENGTH
+#define RECORD_BLOB_SIZE (3 + RECORD_BLOCK_SIZE)
+#define RECORD_HEADER_SIZE 10
+#define RECORD_TUPLE_SIZE 5
+#define RECORD_PAYLOAD_BYTES 32
+#define RECORD_VERSION 1
 
 #define MAX(a, b) (((a) < (b)) ? (b) : (a))
 #define MIN(a, b) (((a) > (b)) ? (b) : (a))
 
-#define STRING_LENGTH 255
 #define NUM_WEATHER_IMAGES	8
 #define SWAP_BOTTOM_LAYER_INTERVAL 15000
 #define GPS_UPDATE_INTERVAL 60000
-#define RECOVERY_ATTEMPT_INTERVAL 10000
+#define RECOVERY_BACKOFF_MIN 5000
+#define RECOVERY_BACKOFF_MAX (10 * 60 * 1000)
+#define RECOVERY_MAX_ATTEMPTS 8
+#define LINK_DEGRADED_FAILURES 3
 #define DEFAULT_SONG_UPDATE_INTERVAL 5000
-
-#define TIMER_COOKIE_WEATHER 1
-#define TIMER_COOKIE_CALANDAR 2
-#define TIMER_COOKIE_MUSIC 3
-#define TIMER_COOKIE_LAYERSWAP 4
-#define TIMER_COOKIE_NEXTDAYWEATHER 5
-#define TIMER_COOKIE_GPS 6
-#define TIMER_COOKIE_CONNECTIONRECOVER 7
-
-typedef enum {MUSIC_LAYER, LOCATION_LAYER, NUM_LAYERS} AnimatedLayers;
+#define OUTBOX_QUEUE_SIZE 8
+#define OUTBOX_MAX_RETRIES 1
+#define OUTBOX_BUSY_RETRY 100
+
+#define SCHED_SLACK 2
+
+/* Appointment countdown, in seconds */
+#define APPT_COUNTDOWN_WINDOW (24 * 60 * 60)
+#define APPT_MAX_SLEEP (6 * 60 * 60)
+#define APPT_YEAR_WRAP (183 * 24 * 60 * 60)
+#define APPT_WARNING_MINUTES 15
+
+#define CAL_QUEUE_SIZE 8
+#define CAL_QUEUE_TITLE_LENGTH 40
+#define CAL_QUEUE_LOW 2
+#define CAL_QUEUE_RESYNC_INTERVAL (6 * 60 * 60 * 1000)
+#define CAL_QUEUE_VERSION 1
+#define CAL_QUEUE_BLOB_SIZE (2 + CAL_QUEUE_SIZE * (7 + CAL_QUEUE_TITLE_LENGTH))
+
+#define WEATHER_RECORD_VERSION 1
+#define WEATHER_FORECAST_DAYS 3
+#define WEATHER_HEADER_SIZE 8
+#define WEATHER_DAY_SIZE 5
+#define WEATHER_BLOB_SIZE (WEATHER_HEADER_SIZE + WEATHER_FORECAST_DAYS * WEATHER_DAY_SIZE)
+#define WEATHER_TEMP_MIN -99
+#define WEATHER_TEMP_MAX 999
+
+#define MUSIC_PROGRESS_SIZE 5
+#define MUSIC_END_SLACK 2
+#define MUSIC_COMMAND_DELAY 1500
+#define MUSIC_BAR_WIDTH 67
+
+/* A trading day of minute ticks, SPARK_BUCKET samples to a drawn column */
+#define SPARK_SAMPLES 390
+#define SPARK_BUCKET 6
+#define SPARK_COLUMNS (SPARK_SAMPLES / SPARK_BUCKET)
+#define SPARK_HEIGHT 15
+#define SPARK_HEADER_SIZE 2
+/* A longer series comes as a reset then plain updates, seq counts on across them */
+#define SPARK_UPDATE_SIZE (SPARK_HEADER_SIZE + 128)
+#define SPARK_RESET 0x01
+#define SPARK_ESCAPE -128
+#define PERSIST_VERSION 2
+#define CACHE_TEXT_LENGTH 64
+#define ICON_CACHE_SLOTS 3
+
+#define LINK_KEY_SLOTS 16
+#define LINK_NUM_RESULTS 15
+#define LINK_LATENCY_BUCKETS 8
+#define LINK_PENDING_SLOTS 4
+#define LINK_STATS_VERSION 2
+#define LINK_DIAG_TEXT_LENGTH 320
+#define LINK_BLOB_SIZE (2 + LINK_KEY_SLOTS * 17 + 2 * LINK_NUM_RESULTS * 2 + LINK_LATENCY_BUCKETS * 2 + 6 + 4 + NUM_LINK_STATES * 4)
+
+#define GOVERNOR_SAVER_PERCENT 30
+#define GOVERNOR_CRITICAL_PERCENT 10
+#define GOVERNOR_IDLE_TIME (30 * 60)
+#define QUIET_HOURS_START 23
+#define QUIET_HOURS_END 7
+
+/* Push subscriptions: a topic the phone accepted is only polled as a keep-alive */
+#define SUB_VERSION 1
+#define SUB_ENTRY_SIZE 3
+#define SUB_BATTERY NUM_TOPICS
+#define NUM_SUBS (NUM_TOPICS + 1)
+#define SUB_BLOB_SIZE (2 + NUM_SUBS * SUB_ENTRY_SIZE)
+#define SUB_KEEPALIVE (60 * 60 * 1000)
+
+/* Reconnect sync: the phone answers a vector of per-topic versions with only what changed */
+#define SYNC_VERSION 1
+#define SYNC_ENTRY_SIZE 3
+#define SYNC_BLOB_SIZE (3 + NUM_TOPICS * SYNC_ENTRY_SIZE)
+#define SYNC_REPLY 0x01
+#define SYNC_REPLY_TIMEOUT 5000
+#define SYNC_STAGGER 2000
+
+/* Activity estimator: 10 Hz in batches, levels are the mean change between samples in mG */
+#define ACTIVITY_BATCH 25
+#define ACTIVITY_STILL_LEVEL 40
+#define ACTIVITY_WALK_LEVEL 250
+#define ACTIVITY_STILL_BATCHES 12
+#define ACTIVITY_LONG_STILL (10 * 60)
+
+/* Text arena slot sizes, sized for what the phone really sends */
+#define TEXT_TEMP_LENGTH 7
+#define TEXT_DATE_LENGTH 20
+#define TEXT_LINE_LENGTH 63
+#define TEXT_CLOCK_LENGTH 5
+#define TEXT_DAY_LENGTH 12
+#define TEXT_TITLE_LENGTH 15
+#define TEXT_QUOTE_LENGTH 11
+#define TEXT_ARENA_SIZE (2 * (TEXT_TEMP_LENGTH + 2) + (TEXT_DATE_LENGTH + 2) + 5 * (TEXT_LINE_LENGTH + 2) + \
+	(TEXT_CLOCK_LENGTH + 2) + (TEXT_DAY_LENGTH + 2) + 2 * (TEXT_TITLE_LENGTH + 2) + 6 * (TEXT_QUOTE_LENGTH + 2))
+
+/* Status canvas layout, the bottom panels slide through the strip at PANEL_Y */
+#define SCREEN_WIDTH 144
+#define PANEL_X 30
+#define PANEL_Y 72
+#define PANEL_WIDTH 75
+#define PANEL_HEIGHT 50
+#define PANEL_SLIDE_DURATION 250
+#define GAUGE_FILL_WIDTH 16
+
+/* Carousel order, a wrist flick brings in the next one */
+typedef enum {MUSIC_LAYER, LOCATION_LAYER, FORECAST_LAYER, STOCKS_LAYER, BITCOIN_LAYER, NUM_LAYERS} AnimatedLayers;
+
+typedef enum {GAUGE_PHONE, GAUGE_PEBBLE, NUM_GAUGES} BatteryGauges;
+
+/* FONT_CALENDAR is whichever bold size fits the event title */
+typedef enum {FONT_SMALL, FONT_SMALL_BOLD, FONT_MEDIUM, FONT_MEDIUM_BOLD, FONT_LARGE_BOLD, FONT_TIME, FONT_CALENDAR,
+	NUM_FONTS} CanvasFonts;
+
+/* Periodic work, all driven by one scheduler instead of one AppTimer each */
+typedef enum {JOB_WEATHER, JOB_CALANDAR, JOB_MUSIC, JOB_LAYERSWAP, JOB_NEXTDAYWEATHER, JOB_GPS, JOB_CONNECTIONRECOVER,
+	JOB_APPOINTMENT, JOB_SYNC, JOB_MUSICBAR, NUM_JOBS} SchedJobs;
+
+/* An exact job never runs before its interval: no slack and no snapping to the minute */
+typedef struct {
+	void (*callback)();
+	time_t due;
+	bool armed;
+	bool exact;
+} SchedJob;
+
+/* Data the phone is polled for, requested together when due together */
+typedef enum {TOPIC_WEATHER, TOPIC_CALENDAR, TOPIC_MUSIC, TOPIC_GPS, NUM_TOPICS} RefreshTopics;
+
+typedef struct {
+	uint16_t batches;
+	uint16_t topics;
+	uint16_t legacy_messages;
+} RefreshStats;
+
+/* One reconnect sync, topics leave pending as their data arrives or the phone calls them unchanged */
+typedef struct {
+	bool active;
+	uint8_t pending;
+	uint8_t requested;
+	uint32_t started;
+	uint16_t count;
+	uint16_t completed;
+	uint32_t last_ms;
+	uint32_t max_ms;
+} TopicSync;
+
+/* Last known data kept across launches, one persist key per category. The first
+   four follow RefreshTopics so their age can be checked against the refresh interval */
+typedef enum {CACHE_WEATHER, CACHE_CALENDAR, CACHE_MUSIC, CACHE_LOCATION, CACHE_BATTERY, CACHE_INTERVALS,
+	CACHE_QUIET_HOURS, NUM_CACHES} CacheCategories;
+
+typedef enum {PERSIST_KEY_VERSION = 1, PERSIST_KEY_WEATHER, PERSIST_KEY_CALENDAR, PERSIST_KEY_MUSIC,
+	PERSIST_KEY_LOCATION, PERSIST_KEY_BATTERY, PERSIST_KEY_INTERVALS, PERSIST_KEY_QUIET_HOURS,
+	PERSIST_KEY_RECORD_HEAD, PERSIST_KEY_RECORD_BLOCK} PersistKeys;
+
+typedef struct {
+	uint32_t updated;
+	char temp[TEXT_TEMP_LENGTH + 1];
+	char tomorrow_temp[TEXT_TEMP_LENGTH + 1];
+	uint8_t icon;
+	uint8_t tomorrow_icon;
+} CacheWeather;
+
+typedef struct {
+	uint32_t updated;
+	char time[15];
+	char text[CACHE_TEXT_LENGTH];
+} CacheCalendar;
+
+typedef struct {
+	uint32_t updated;
+	char artist[CACHE_TEXT_LENGTH];
+	char title[CACHE_TEXT_LENGTH];
+} CacheMusic;
+
+typedef struct {
+	uint32_t updated;
+	char street[CACHE_TEXT_LENGTH];
+} CacheLocation;
+
+typedef struct {
+	uint32_t updated;
+	uint8_t percent;
+} CacheBattery;
+
+typedef struct {
+	int32_t weather;
+	int32_t calendar;
+	int32_t gps;
+} CacheIntervals;
+
+/* Local hours, start == end disables quiet hours */
+typedef struct {
+	uint8_t start;
+	uint8_t end;
+} CacheQuietHours;
+
+/* One upcoming event, duration in minutes */
+typedef struct {
+	time_t start;
+	uint16_t duration;
+	char title[CAL_QUEUE_TITLE_LENGTH + 1];
+} CalEvent;
+
+/* Decoded SM_WEATHER_DATA_KEY, days[0] is tomorrow */
+typedef struct {
+	int16_t high;
+	int16_t low;
+	uint8_t icon;
+} WeatherDay;
+
+typedef struct {
+	int16_t temp;
+	uint8_t icon;
+	uint8_t humidity;
+	uint8_t wind;
+	uint8_t num_days;
+	WeatherDay days[WEATHER_FORECAST_DAYS];
+} WeatherRecord;
+
+/* Play state as the phone reported it, elapsed counts from at while playing */
+typedef enum {MUSIC_STOPPED, MUSIC_PLAYING, MUSIC_PAUSED} MusicStates;
+
+typedef struct {
+	uint8_t state;
+	uint16_t elapsed;
+	uint16_t duration;
+	time_t at;
+} MusicProgress;
+
+typedef enum {SPARK_STOCKS, SPARK_BITCOIN, NUM_SPARKS} SparkFeeds;
+
+/* Quantized samples in a ring, plus the pixel row of each drawn column. Columns close on
+   their newest sample and move left one at a time as new ones open on the right */
+typedef struct {
+	uint8_t samples[SPARK_SAMPLES];
+	uint8_t rows[SPARK_COLUMNS];
+	uint16_t head;
+	uint16_t count;
+	uint8_t columns;
+	uint8_t bucket_fill;
+	uint8_t seq;
+	uint8_t low;
+	uint8_t high;
+	bool active;
+} Sparkline;
+
+/* What the wrist is doing, as far as location refresh cares */
+typedef enum {ACTIVITY_STILL, ACTIVITY_WALKING, ACTIVITY_VEHICLE, NUM_ACTIVITIES} Activities;
+
+typedef struct {
+	uint8_t state;
+	uint8_t still_batches;
+	int32_t level;
+	time_t still_since;
+} ActivityEstimator;
+
+/* Polling tiers, from full cadence down to only what is worth a wake-up */
+typedef enum {TIER_NORMAL, TIER_SAVER, TIER_CRITICAL, TIER_NIGHT, NUM_TIERS} PowerTiers;
+
+/* Everything the status screen shows, one dirty bit per field */
+typedef enum {FIELD_WEATHER_TEMP, FIELD_WEATHER_ICON, FIELD_TOMORROW_TEMP, FIELD_TOMORROW_ICON, FIELD_LOCATION,
+	FIELD_CALENDAR_DATE, FIELD_CALENDAR_TEXT, FIELD_MUSIC_ARTIST, FIELD_MUSIC_TITLE, FIELD_MUSIC_PROGRESS,
+	FIELD_PHONE_BATTERY, FIELD_PEBBLE_BATTERY, FIELD_TIME, FIELD_DATE, FIELD_STATUS, FIELD_FORECAST,
+	FIELD_STOCKS_TITLE, FIELD_STOCKS_PRICE, FIELD_STOCKS_LOW, FIELD_STOCKS_HIGH,
+	FIELD_BITCOIN_TITLE, FIELD_BITCOIN_PRICE, FIELD_BITCOIN_LOW, FIELD_BITCOIN_HIGH,
+	FIELD_STOCKS_GRAPH, FIELD_BITCOIN_GRAPH, NUM_FIELDS} StatusFields;
+
+/* Texts are kept in the arena, see TEXT_FIELDS for the field each one redraws */
+typedef enum {TEXT_WEATHER_TEMP, TEXT_TOMORROW_TEMP, TEXT_LOCATION, TEXT_CALENDAR_DATE, TEXT_CALENDAR_TEXT,
+	TEXT_MUSIC_ARTIST, TEXT_MUSIC_TITLE, TEXT_TIME, TEXT_DATE, TEXT_FORECAST,
+	TEXT_STOCKS_TITLE, TEXT_STOCKS_PRICE, TEXT_STOCKS_LOW, TEXT_STOCKS_HIGH,
+	TEXT_BITCOIN_TITLE, TEXT_BITCOIN_PRICE, TEXT_BITCOIN_LOW, TEXT_BITCOIN_HIGH, NUM_TEXTS} TextSlots;
+
+typedef struct {
+	int32_t weather_icon;
+	int32_t tomorrow_icon;
+	int32_t phone_battery;
+	int32_t pebble_battery;
+	int32_t music_progress;
+	const char *status;
+} StatusState;
+
+typedef struct {
+	uint16_t redraws[NUM_FIELDS];
+	uint16_t skipped[NUM_FIELDS];
+} StateStats;
+
+/* Where a field is drawn, NUM_LAYERS for fixed ones. Panel fields are relative to their panel */
+typedef struct {
+	GRect frame;
+	uint8_t panel;
+} CanvasRegion;
+
+/* A text drawn in its field's region, slot NUM_TEXTS is the status line */
+typedef struct {
+	uint8_t field;
+	uint8_t slot;
+	uint8_t font;
+	uint8_t align;
+} CanvasText;
+
+/* Battery outline and device icon, the fill goes in the field's region */
+typedef struct {
+	uint8_t field;
+	const int32_t *percent;
+	uint32_t icon_resource;
+	GRect outline;
+	GRect icon;
+} CanvasGauge;
+
+/* One loaded weather icon, refs counts the places showing it */
+typedef struct {
+	GBitmap *bitmap;
+	int8_t id;
+	uint8_t refs;
+	uint8_t used;
+} IconSlot;
+
+/* Inbound dispatch: handler plus what its tuple must look like */
+#define RCV_TYPE_CSTRING	(1 << TUPLE_CSTRING)
+#define RCV_TYPE_INT		((1 << TUPLE_UINT) | (1 << TUPLE_INT))
+#define RCV_TYPE_DATA		(1 << TUPLE_BYTE_ARRAY)
+
+typedef void (*RcvHandler)(const Tuple *t);
+
+typedef struct {
+	RcvHandler handler;
+	uint8_t types;
+	uint16_t min_length;
+	uint16_t max_length;
+} RcvEntry;
+
+/* Event callbacks whose rendering cost is profiled, see prof_begin */
+typedef enum {PROF_RCV, PROF_DROPPED, PROF_SENT, PROF_FAILED, PROF_TICK, PROF_TIMER, PROF_TAP, PROF_BATTERY,
+	PROF_BLUETOOTH, PROF_ACCEL, NUM_PROF_EVENTS} ProfEvents;
+
+typedef struct {
+	uint16_t events;
+	uint16_t marks;
+	uint16_t draws;
+	uint32_t pixels;
+	uint32_t time_total;
+	uint16_t time_max;
+} ProfStats;
+
+/* AppMessage traffic for one key, outbound counts go to the key a queued command was sent for */
+typedef struct {
+	uint8_t key;
+	uint16_t sent;
+	uint16_t acked;
+	uint16_t failed;
+	uint16_t received;
+	uint32_t bytes_out;
+	uint32_t bytes_in;
+} LinkKeyStats;
+
+/* Results are bit flags, failures and drops are counted by bit position */
+typedef struct {
+	uint8_t keys_used;
+	uint16_t failed[LINK_NUM_RESULTS];
+	uint16_t dropped[LINK_NUM_RESULTS];
+	uint16_t latency[LINK_LATENCY_BUCKETS];
+	uint16_t unmatched;
+	uint32_t latency_max;
+} LinkStats;
+
+typedef struct {
+	uint32_t sequence;
+	uint32_t sent_at;
+} LinkPending;
+
+/* Connected: last exchange went through. Degraded: transient errors, nothing resent.
+   Recovering: probing with backoff. Down: phone unreachable, only a reconnect or a button press wakes it */
+typedef enum {LINK_CONNECTED, LINK_DEGRADED, LINK_RECOVERING, LINK_DOWN, NUM_LINK_STATES} LinkStates;
+
+typedef struct {
+	uint8_t state;
+	uint8_t attempts;
+	uint8_t failures;
+	bool desync;
+	time_t since;
+	uint32_t time_in[NUM_LINK_STATES];
+	uint16_t resyncs;
+} LinkRecovery;
+
+/* What happened, args are noted next to each event */
+typedef enum {
+	TRACE_SEQUENCE_RESET,	// -
+	TRACE_SEND,				// key, param
+	TRACE_OUTBOX_DROP,		// key, result
+	TRACE_SENT,				// key, -
+	TRACE_SEND_FAILED,		// key, result
+	TRACE_DROPPED,			// -, result
+	TRACE_RECEIVED,			// key, length
+	TRACE_JOB,				// job, -
+	TRACE_BLUETOOTH,		// connected, -
+	TRACE_TIER,				// tier, stale topics
+	TRACE_LINK_STATE,		// state, attempts
+	TRACE_ACTIVITY,			// state, smoothed level
+	TRACE_SYNC,				// topics still pending, ms since reconnect
+	TRACE_UNLOAD,			// -
+	NUM_TRACE_EVENTS
+} TraceEvents;
+
+/* Fixed size so recording is a few stores, time is in ms and wraps */
+typedef struct {
+	uint32_t time;
+	uint16_t event;
+	uint16_t arg0;
+	uint32_t arg1;
+} TraceRecord;
+
+/* What a traffic record holds, RECORD_START opens each launch */
+typedef enum {RECORD_START, RECORD_IN, RECORD_SENT, RECORD_FAILED, RECORD_DROPPED} RecordDirections;
+
+/* Outgoing commands are queued by class, user buttons always go first */
+typedef enum {OUTBOX_PRIO_USER, OUTBOX_PRIO_REFRESH, NUM_OUTBOX_PRIOS} OutboxPriority;
+
+typedef struct {
+	uint32_t key;
+	int8_t param;
+	uint8_t prio;
+	uint8_t retries;
+	uint32_t queued_at;
+} OutboxEntry;
+
+typedef struct {
+	uint8_t depth;
+	uint8_t max_depth;
+	uint16_t coalesced;
+	uint16_t evicted;
+	uint16_t user_lost;
+	uint16_t user_sent;
+	uint32_t user_latency_last;
+	uint32_t user_latency_max;
+	uint32_t user_latency_total;
+} OutboxStats;
 
 
 static AppMessageResult sm_message_out_get(DictionaryIterator **iter_out);
 static void reset_sequence_number();
 
+#if TRACE_LEVEL > 0
+static void trace_record(uint16_t event, uint16_t arg0, uint32_t arg1);
+static void trace_dump_log();
+#endif
+
+static void prof_begin(uint8_t event);
+static void prof_mark(GRect frame);
+static void prof_draw(uint8_t calls);
+static void prof_end(uint8_t event);
+
+static void link_count_received(const Tuple *t);
+static void link_match_reply(uint32_t sequence);
+static uint16_t link_write_blob(DictionaryIterator *iter);
+static bool sub_write_blob(DictionaryIterator *iter);
+static bool sync_write_blob(DictionaryIterator *iter);
+static void sync_arrived(uint8_t topic);
+static void timer_cbk_sync();
+
+static void outbox_push(uint32_t key, int8_t param, OutboxPriority prio);
+static void outbox_drain();
 static void sendCommand(int key);
 static void sendCommandInt(int key, int param);
+static void sendRefresh(int key);
+static void sendRefreshInt(int key, int param);
+static void sched_arm(uint8_t job, int32_t interval);
+static void sched_cancel(uint8_t job);
+static void sched_cancel_all();
+static void sched_run_due();
+static void sched_timer_cbk(void *data);
+static void refresh_request(uint8_t topic);
+static bool refresh_write_batch(DictionaryIterator *iter, uint8_t topics);
+static void refresh_flush();
 static void rcv(DictionaryIterator *received, void *context);
 static void dropped(AppMessageResult reason, void *context);
 static void select_up_handler(ClickRecognizerRef recognizer, void *context);
@@ -37,32 +519,30 @@ static void select_down_handler(ClickRecognizerRef recognizer, void *context);
 static void up_single_click_handler(ClickRecognizerRef recognizer, void *context);
 static void down_single_click_handler(ClickRecognizerRef recognizer, void *context);
 static void config_provider();
-static void battery_layer_update_callback(Layer *me, GContext* ctx);
-static void pebble_battery_layer_update_callback(Layer *me, GContext* ctx);
 static void handle_status_appear(Window *window);
 static void handle_status_disappear(Window *window);
 static void handle_minute_tick(struct tm* tick_time, TimeUnits units_changed);
 static void reset();	
+static bool panel_shown(int32_t panel);
 static void swap_bottom_layer();
+static void governor_arm(uint8_t topic, int32_t interval);
+static int32_t refresh_interval(uint8_t topic);
+static void music_command(int key);
+static void music_progress_update();
+static void cal_queue_advance();
+static bool sm_key_known(uint32_t key);
+static uint8_t governor_sync();
+static void governor_catch_up(uint8_t stale);
 	
-static Window *window;
-static PropertyAnimation *ani_out, *ani_in;
-
-static Layer *animated_layer[NUM_LAYERS], *weather_layer;
-static Layer *battery_layer, *battery_ind_layer, *calendar_layer;
-static Layer *pebble_battery_layer, *pebble_battery_ind_layer;
-
-static TextLayer *text_date_layer, *text_time_layer;
+static Window *window, *diag_window;
 
-static TextLayer *text_weather_temp_layer, *text_weather_tomorrow_temp_layer, *text_battery_layer;
-static TextLayer *calendar_date_layer, *calendar_text_layer, *text_status_layer;
-static TextLayer *music_artist_layer, *music_song_layer, *location_street_layer;
- 
-static BitmapLayer *background_image, *weather_image, *weather_tomorrow_image;
-static BitmapLayer *battery_image_layer, *pebble_battery_image_layer;
-static BitmapLayer *phone_icon_layer, *pebble_icon_layer;
+static Layer *canvas_layer;
+static GFont canvas_fonts[NUM_FONTS];
+static Animation *panel_animation;
 
 static int32_t active_layer;
+static int32_t panel_leaving = NUM_LAYERS;
+static uint32_t panel_progress = ANIMATION_NORMALIZED_MAX;
 static int32_t updateGPSInterval = GPS_UPDATE_INTERVAL;
 static int32_t updateCalandarInterval = 60000;
 static int32_t updateWeatherInterval = 60000;
@@ -75,24 +555,120 @@ static int8_t current_app = -1;
 static bool battery_low = false;
 static bool pebble_battery_low = false;
 
-static char string_buffer[STRING_LENGTH], location_street_str[STRING_LENGTH], appointment_time[15];
-static char weather_cond_str[STRING_LENGTH], weather_tomorrow_temp_str[5], weather_temp_str[5];
-static int32_t weather_img, weather_tomorrow_img, batteryPercent, pebble_batteryPercent;
+static char appointment_time[15];
+static time_t appointment_at = 0;
+static bool appt_warned = false, appt_started = false;
+
+static MusicProgress music_progress;
+static bool music_progress_active = false;
+
+/* Moving until the first batches say otherwise, so location refreshes as before */
+static ActivityEstimator activity = {ACTIVITY_WALKING, 0, ACTIVITY_WALK_LEVEL, 0};
+
+static WeatherRecord weather_record;
+static bool weather_record_active = false;
+
+static Sparkline sparks[NUM_SPARKS];
+static const uint8_t SPARK_FIELDS[NUM_SPARKS] = {FIELD_STOCKS_GRAPH, FIELD_BITCOIN_GRAPH};
+static const uint8_t SPARK_PANELS[NUM_SPARKS] = {STOCKS_LAYER, BITCOIN_LAYER};
 
-static char calendar_date_str[STRING_LENGTH], calendar_text_str[STRING_LENGTH];
-static char music_artist_str[STRING_LENGTH], music_title_str[STRING_LENGTH];
+/* Topics the phone pushes, by RefreshTopics bit. Cleared whenever the link drops */
+static uint8_t sub_active = 0;
+
+/* Version of the data held per topic as the phone stamped it, 0 for none yet */
+static uint16_t sync_versions[NUM_TOPICS];
+static TopicSync topic_sync;
+
+static CalEvent cal_queue[CAL_QUEUE_SIZE];
+static uint8_t cal_queue_count = 0;
+static bool cal_queue_active = false;
+
+static const uint8_t TEXT_CAPACITY[NUM_TEXTS] = {
+	TEXT_TEMP_LENGTH, TEXT_TEMP_LENGTH, TEXT_LINE_LENGTH, TEXT_DATE_LENGTH, TEXT_LINE_LENGTH,
+	TEXT_LINE_LENGTH, TEXT_LINE_LENGTH, TEXT_CLOCK_LENGTH, TEXT_DAY_LENGTH, TEXT_LINE_LENGTH,
+	TEXT_TITLE_LENGTH, TEXT_QUOTE_LENGTH, TEXT_QUOTE_LENGTH, TEXT_QUOTE_LENGTH,
+	TEXT_TITLE_LENGTH, TEXT_QUOTE_LENGTH, TEXT_QUOTE_LENGTH, TEXT_QUOTE_LENGTH
+};
+static const uint8_t TEXT_FIELDS[NUM_TEXTS] = {
+	FIELD_WEATHER_TEMP, FIELD_TOMORROW_TEMP, FIELD_LOCATION, FIELD_CALENDAR_DATE, FIELD_CALENDAR_TEXT,
+	FIELD_MUSIC_ARTIST, FIELD_MUSIC_TITLE, FIELD_TIME, FIELD_DATE, FIELD_FORECAST,
+	FIELD_STOCKS_TITLE, FIELD_STOCKS_PRICE, FIELD_STOCKS_LOW, FIELD_STOCKS_HIGH,
+	FIELD_BITCOIN_TITLE, FIELD_BITCOIN_PRICE, FIELD_BITCOIN_LOW, FIELD_BITCOIN_HIGH
+};
+static uint16_t text_offset[NUM_TEXTS];
+static char text_arena[TEXT_ARENA_SIZE];
+
+static StatusState status_state;
+static uint32_t state_dirty = 0;
+static StateStats state_stats;
+
+/* The whole status screen, one region per field */
+static const CanvasRegion CANVAS_REGIONS[NUM_FIELDS] = {
+	[FIELD_WEATHER_TEMP]	= {{{5, 93}, {25, 20}}, NUM_LAYERS},
+	[FIELD_WEATHER_ICON]	= {{{5, 74}, {20, 20}}, NUM_LAYERS},
+	[FIELD_TOMORROW_TEMP]	= {{{105, 93}, {31, 20}}, NUM_LAYERS},
+	[FIELD_TOMORROW_ICON]	= {{{112, 74}, {20, 20}}, NUM_LAYERS},
+	[FIELD_LOCATION]		= {{{0, 0}, {PANEL_WIDTH, 47}}, LOCATION_LAYER},
+	[FIELD_CALENDAR_DATE]	= {{{6, 124}, {132, 21}}, NUM_LAYERS},
+	[FIELD_CALENDAR_TEXT]	= {{{6, 139}, {132, 29}}, NUM_LAYERS},
+	[FIELD_MUSIC_ARTIST]	= {{{0, 0}, {PANEL_WIDTH, 24}}, MUSIC_LAYER},
+	[FIELD_MUSIC_TITLE]		= {{{0, 25}, {PANEL_WIDTH, 25}}, MUSIC_LAYER},
+	[FIELD_MUSIC_PROGRESS]	= {{{(PANEL_WIDTH - MUSIC_BAR_WIDTH) / 2, 47}, {MUSIC_BAR_WIDTH, 2}}, MUSIC_LAYER},
+	[FIELD_PHONE_BATTERY]	= {{{109, 54}, {19, 11}}, NUM_LAYERS},
+	[FIELD_PEBBLE_BATTERY]	= {{{9, 54}, {19, 11}}, NUM_LAYERS},
+	[FIELD_TIME]			= {{{0, -5}, {SCREEN_WIDTH, 50}}, NUM_LAYERS},
+	[FIELD_DATE]			= {{{47, 48}, {50, 30}}, NUM_LAYERS},
+	[FIELD_STATUS]			= {{{6, 110}, {138, 20}}, NUM_LAYERS},
+	[FIELD_FORECAST]		= {{{0, 0}, {PANEL_WIDTH, 47}}, FORECAST_LAYER},
+	[FIELD_STOCKS_TITLE]	= {{{0, 0}, {38, 16}}, STOCKS_LAYER},
+	[FIELD_STOCKS_PRICE]	= {{{38, 0}, {37, 16}}, STOCKS_LAYER},
+	[FIELD_STOCKS_LOW]		= {{{0, 33}, {37, 16}}, STOCKS_LAYER},
+	[FIELD_STOCKS_HIGH]		= {{{38, 33}, {37, 16}}, STOCKS_LAYER},
+	[FIELD_BITCOIN_TITLE]	= {{{0, 0}, {38, 16}}, BITCOIN_LAYER},
+	[FIELD_BITCOIN_PRICE]	= {{{38, 0}, {37, 16}}, BITCOIN_LAYER},
+	[FIELD_BITCOIN_LOW]		= {{{0, 33}, {37, 16}}, BITCOIN_LAYER},
+	[FIELD_BITCOIN_HIGH]	= {{{38, 33}, {37, 16}}, BITCOIN_LAYER},
+	[FIELD_STOCKS_GRAPH]	= {{{(PANEL_WIDTH - SPARK_COLUMNS) / 2, 18}, {SPARK_COLUMNS, SPARK_HEIGHT}}, STOCKS_LAYER},
+	[FIELD_BITCOIN_GRAPH]	= {{{(PANEL_WIDTH - SPARK_COLUMNS) / 2, 18}, {SPARK_COLUMNS, SPARK_HEIGHT}}, BITCOIN_LAYER}
+};
+
+/* In drawing order, panels last so they slide over the weather */
+static const CanvasText CANVAS_TEXTS[] = {
+	{FIELD_WEATHER_TEMP, TEXT_WEATHER_TEMP, FONT_SMALL_BOLD, GTextAlignmentCenter},
+	{FIELD_TOMORROW_TEMP, TEXT_TOMORROW_TEMP, FONT_SMALL, GTextAlignmentCenter},
+	{FIELD_DATE, TEXT_DATE, FONT_MEDIUM, GTextAlignmentLeft},
+	{FIELD_TIME, TEXT_TIME, FONT_TIME, GTextAlignmentCenter},
+	{FIELD_STATUS, NUM_TEXTS, FONT_SMALL, GTextAlignmentLeft},
+	{FIELD_CALENDAR_DATE, TEXT_CALENDAR_DATE, FONT_MEDIUM, GTextAlignmentLeft},
+	{FIELD_CALENDAR_TEXT, TEXT_CALENDAR_TEXT, FONT_CALENDAR, GTextAlignmentLeft},
+	{FIELD_MUSIC_ARTIST, TEXT_MUSIC_ARTIST, FONT_SMALL, GTextAlignmentCenter},
+	{FIELD_MUSIC_TITLE, TEXT_MUSIC_TITLE, FONT_SMALL_BOLD, GTextAlignmentCenter},
+	{FIELD_LOCATION, TEXT_LOCATION, FONT_SMALL, GTextAlignmentCenter},
+	{FIELD_FORECAST, TEXT_FORECAST, FONT_SMALL, GTextAlignmentCenter},
+	{FIELD_STOCKS_TITLE, TEXT_STOCKS_TITLE, FONT_SMALL_BOLD, GTextAlignmentLeft},
+	{FIELD_STOCKS_PRICE, TEXT_STOCKS_PRICE, FONT_SMALL_BOLD, GTextAlignmentRight},
+	{FIELD_STOCKS_LOW, TEXT_STOCKS_LOW, FONT_SMALL, GTextAlignmentLeft},
+	{FIELD_STOCKS_HIGH, TEXT_STOCKS_HIGH, FONT_SMALL, GTextAlignmentRight},
+	{FIELD_BITCOIN_TITLE, TEXT_BITCOIN_TITLE, FONT_SMALL_BOLD, GTextAlignmentLeft},
+	{FIELD_BITCOIN_PRICE, TEXT_BITCOIN_PRICE, FONT_SMALL_BOLD, GTextAlignmentRight},
+	{FIELD_BITCOIN_LOW, TEXT_BITCOIN_LOW, FONT_SMALL, GTextAlignmentLeft},
+	{FIELD_BITCOIN_HIGH, TEXT_BITCOIN_HIGH, FONT_SMALL, GTextAlignmentRight}
+};
+#define NUM_CANVAS_TEXTS (sizeof(CANVAS_TEXTS) / sizeof(CANVAS_TEXTS[0]))
 
+static const CanvasGauge CANVAS_GAUGES[NUM_GAUGES] = {
+	[GAUGE_PHONE]	= {FIELD_PHONE_BATTERY, &status_state.phone_battery, RESOURCE_ID_PHONE_ICON,
+		{{107, 53}, {23, 14}}, {{90, 50}, {20, 20}}},
+	[GAUGE_PEBBLE]	= {FIELD_PEBBLE_BATTERY, &status_state.pebble_battery, RESOURCE_ID_PEBBLE_ICON,
+		{{7, 53}, {23, 14}}, {{26, 50}, {20, 20}}}
+};
 
-static GBitmap *battery_image, *pebble_battery_image, *phone_icon, *pebble_icon;
-static GBitmap *weather_status_small_imgs[NUM_WEATHER_IMAGES];
+static GBitmap *battery_image, *gauge_icons[NUM_GAUGES];
+static GBitmap *weather_bitmap, *tomorrow_bitmap;
 
-static AppTimer *timerUpdateCalendar = NULL;
-static AppTimer *timerUpdateWeather = NULL;
-static AppTimer *timerUpdateMusic = NULL;
-static AppTimer *timerSwapBottomLayer = NULL;
-static AppTimer *timerUpdateWeatherForecast = NULL;
-static AppTimer *timerUpdateGps = NULL;
-static AppTimer *timerRecoveryAttempt = NULL;
+static IconSlot icon_cache[ICON_CACHE_SLOTS];
+static uint8_t icon_cache_clock = 0;
+static int8_t weather_image_icon = -1, weather_tomorrow_image_icon = -1;
 
 const int WEATHER_SMALL_IMG_IDS[] = {
   RESOURCE_ID_IMAGE_SUN_SMALL,
@@ -105,525 +681,2461 @@ const int WEATHER_SMALL_IMG_IDS[] = {
   RESOURCE_ID_IMAGE_THUNDER_SMALL
 };
 
-static char local_debug_str[STRING_LENGTH];
-#define LOCAL_DEBUG(level, format, ...) \
+/* Compiles to nothing above TRACE_LEVEL */
+#if TRACE_LEVEL > 0
+#define TRACE(level, event, arg0, arg1) \
 	do { \
-		snprintf(local_debug_str, STRING_LENGTH, format, ## __VA_ARGS__); \
-		text_layer_set_text(text_status_layer, local_debug_str); \
+		if(TRACE_LEVEL >= (level)) \
+			trace_record((event), (arg0), (arg1)); \
 	   } while(0)
+#else
+#define TRACE(level, event, arg0, arg1) do {} while(0)
+#endif
 
 static uint32_t s_sequence_number = 0xFFFFFFFE;
 
-/* Convert letter to digit */
-static int letter2digit(char letter) {
-	if((letter >= 48) && (letter <=57)) {
-		return (int)letter - 48;
+#if TRACE_LEVEL > 0
+static TraceRecord trace_ring[TRACE_RING_SIZE];
+static uint8_t trace_next = 0;
+static bool trace_wrapped = false;
+#endif
+
+static const char * const PROF_EVENT_NAMES[NUM_PROF_EVENTS] = {
+	"rcv", "dropped", "sent", "failed", "tick", "timer", "tap", "battery", "bluetooth", "accel"
+};
+static ProfStats prof_stats[NUM_PROF_EVENTS];
+static ProfStats prof_frame;
+static uint8_t prof_event = NUM_PROF_EVENTS;
+static uint32_t prof_started = 0;
+
+static LinkKeyStats link_keys[LINK_KEY_SLOTS];
+static LinkStats link_stats;
+static LinkPending link_pending[LINK_PENDING_SLOTS];
+static LinkRecovery link_recovery;
+static const char * const LINK_STATE_NAMES[NUM_LINK_STATES] = {"Connected", "Degraded", "Recovering", "Down"};
+static uint8_t link_pending_next = 0;
+
+static uint8_t *record_block = NULL;
+static uint16_t record_fill = 0;
+static uint8_t record_head = 0;
+
+static TextLayer *diag_text_layer;
+static char *diag_text = NULL;
+static bool diag_app_page = false;
+
+static OutboxEntry outbox_queue[OUTBOX_QUEUE_SIZE];
+static OutboxEntry outbox_in_flight;
+static uint8_t outbox_count = 0;
+static AppTimer *outbox_retry_timer = NULL;
+static OutboxStats outbox_stats;
+
+// Weather icon cache
+/* Icons are loaded on demand, a slot is only reused once no layer shows it */
+static GBitmap *icon_acquire(int32_t id) {
+	uint8_t i, age, oldest = 0, victim = ICON_CACHE_SLOTS;
+
+	if((id < 0) || (id >= NUM_WEATHER_IMAGES)) return NULL;
+
+	for(i = 0; i < ICON_CACHE_SLOTS; i++) {
+		if(icon_cache[i].bitmap && (icon_cache[i].id == id)) {
+			icon_cache[i].refs++;
+			icon_cache[i].used = ++icon_cache_clock;
+			return icon_cache[i].bitmap;
+		}
 	}
-	
-	return -1;
+
+	// Free slot first, otherwise the least recently used unreferenced one
+	for(i = 0; i < ICON_CACHE_SLOTS; i++) {
+		if(!icon_cache[i].bitmap) {
+			victim = i;
+			break;
+		}
+		if(icon_cache[i].refs) continue;
+		age = icon_cache_clock - icon_cache[i].used;
+		if((victim == ICON_CACHE_SLOTS) || (age > oldest)) {
+			victim = i;
+			oldest = age;
+		}
+	}
+	if(victim == ICON_CACHE_SLOTS) return NULL;
+
+	if(icon_cache[victim].bitmap)
+		gbitmap_destroy(icon_cache[victim].bitmap);
+
+	icon_cache[victim].bitmap = gbitmap_create_with_resource(WEATHER_SMALL_IMG_IDS[id]);
+	if(!icon_cache[victim].bitmap) return NULL;
+	icon_cache[victim].id = id;
+	icon_cache[victim].refs = 1;
+	icon_cache[victim].used = ++icon_cache_clock;
+	return icon_cache[victim].bitmap;
+}
+
+static void icon_release(int32_t id) {
+	uint8_t i;
+
+	for(i = 0; i < ICON_CACHE_SLOTS; i++) {
+		if(icon_cache[i].bitmap && (icon_cache[i].id == id) && icon_cache[i].refs) {
+			icon_cache[i].refs--;
+			return;
+		}
+	}
+}
+
+/* Swap the icon drawn in one place, keeping the old one if the new id is bad */
+static void icon_show(GBitmap **drawn, int8_t *shown, int32_t id) {
+	GBitmap *bitmap;
+
+	if(id == *shown) return;
+
+	bitmap = icon_acquire(id);
+	if(!bitmap) return;
+
+	*drawn = bitmap;
+	if(*shown >= 0)
+		icon_release(*shown);
+	*shown = id;
+}
+
+static void icon_cache_destroy() {
+	uint8_t i;
+
+	for(i = 0; i < ICON_CACHE_SLOTS; i++) {
+		if(icon_cache[i].bitmap)
+			gbitmap_destroy(icon_cache[i].bitmap);
+		icon_cache[i].bitmap = NULL;
+		icon_cache[i].refs = 0;
+	}
+	weather_image_icon = weather_tomorrow_image_icon = -1;
+	weather_bitmap = tomorrow_bitmap = NULL;
+}
+
+// Text arena
+/* Each slot is a length byte, the text and its NUL, the canvas draws straight from it */
+static void text_arena_init() {
+	uint8_t slot;
+	uint16_t offset = 0;
+
+	for(slot = 0; slot < NUM_TEXTS; slot++) {
+		text_offset[slot] = offset;
+		text_arena[offset] = 0;
+		text_arena[offset + 1] = '\0';
+		offset += TEXT_CAPACITY[slot] + 2;
+	}
+}
+
+static char *text_get(uint8_t slot) {
+	return text_arena + text_offset[slot] + 1;
+}
+
+static uint8_t text_length(uint8_t slot) {
+	return (uint8_t)text_arena[text_offset[slot]];
+}
+
+/* Copy length bytes in place, cut back to a whole UTF-8 character when too long. False if unchanged */
+static bool text_store(uint8_t slot, const char *src, size_t length) {
+	char *dst = text_get(slot);
+
+	if(length > TEXT_CAPACITY[slot]) {
+		length = TEXT_CAPACITY[slot];
+		while((length > 0) && ((src[length] & 0xC0) == 0x80)) length--;
+	}
+
+	if((length == text_length(slot)) && (memcmp(dst, src, length) == 0)) return false;
+
+	memcpy(dst, src, length);
+	dst[length] = '\0';
+	text_arena[text_offset[slot]] = (char)length;
+	return true;
+}
+
+/* Text of a validated cstring tuple, without its NUL */
+static size_t tuple_text_length(const Tuple *t) {
+	return t->length - 1;
+}
+
+// Status screen state
+static void state_set_text(uint8_t slot, const char *src, size_t length) {
+	if(!text_store(slot, src, length)) {
+		state_stats.skipped[TEXT_FIELDS[slot]]++;
+		return;
+	}
+
+	state_dirty |= (1 << TEXT_FIELDS[slot]);
+}
+
+static void state_set_string(uint8_t slot, const char *src) {
+	state_set_text(slot, src, strlen(src));
+}
+
+static void state_set_int(uint8_t field, int32_t *dst, int32_t value) {
+	if(*dst == value) {
+		state_stats.skipped[field]++;
+		return;
+	}
+
+	*dst = value;
+	state_dirty |= (1 << field);
+}
+
+/* Status line texts are literals, a NULL forces the next one through */
+static void state_set_status(const char *text) {
+	if(status_state.status && (strcmp(status_state.status, text) == 0)) {
+		state_stats.skipped[FIELD_STATUS]++;
+		return;
+	}
+
+	status_state.status = text;
+	state_dirty |= (1 << FIELD_STATUS);
+}
+
+/* Prepare changed fields and invalidate the canvas once per event. Fields of a panel
+   that is off screen are drawn the next time it slides in */
+static void state_flush() {
+	uint8_t field, len, panel;
+	bool marked = false;
+
+	for(field = 0; state_dirty && (field < NUM_FIELDS); field++) {
+		if(!(state_dirty & (1 << field))) continue;
+		state_dirty &= ~(1 << field);
+		state_stats.redraws[field]++;
+
+		switch(field) {
+			case FIELD_WEATHER_ICON:
+				icon_show(&weather_bitmap, &weather_image_icon, status_state.weather_icon);
+				break;
+			case FIELD_TOMORROW_ICON:
+				icon_show(&tomorrow_bitmap, &weather_tomorrow_image_icon, status_state.tomorrow_icon);
+				break;
+			case FIELD_CALENDAR_TEXT:
+				len = text_length(TEXT_CALENDAR_TEXT);
+				if(len <= 15)
+					canvas_fonts[FONT_CALENDAR] = canvas_fonts[FONT_LARGE_BOLD];
+				else
+					if(len <= 18)
+						canvas_fonts[FONT_CALENDAR] = canvas_fonts[FONT_MEDIUM_BOLD];
+					else 
+						canvas_fonts[FONT_CALENDAR] = canvas_fonts[FONT_SMALL_BOLD];
+				break;
+		}
+
+		panel = CANVAS_REGIONS[field].panel;
+		if((panel != NUM_LAYERS) && !panel_shown(panel)) continue;
+		prof_mark(CANVAS_REGIONS[field].frame);
+		marked = true;
+	}
+
+	if(marked)
+		layer_mark_dirty(canvas_layer);
+
+	if(DEBUG)
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "Redraws: location %d (%d skipped), music %d (%d skipped)",
+				state_stats.redraws[FIELD_LOCATION], state_stats.skipped[FIELD_LOCATION],
+				state_stats.redraws[FIELD_MUSIC_ARTIST], state_stats.skipped[FIELD_MUSIC_ARTIST]);
+}
+
+/* Integer value of a tuple, whatever width the phone used */
+static int32_t tuple_int(const Tuple *t) {
+	switch(t->length) {
+		case 1:
+			return (t->type == TUPLE_INT) ? t->value->int8 : t->value->uint8;
+		case 2:
+			return (t->type == TUPLE_INT) ? t->value->int16 : t->value->uint16;
+		default:
+			return t->value->int32;
+	}
+}
+
+// Appointment
+/* Digits at *p up to the next non-digit, -1 if there are none */
+static int32_t appt_number(const char **p) {
+	int32_t value = 0;
+	const char *start = *p;
+
+	while((**p >= '0') && (**p <= '9')) {
+		value = value * 10 + (**p - '0');
+		(*p)++;
+	}
+	return (*p == start) ? -1 : value;
+}
+
+/* "mm/dd hh:mm" in local time to an absolute time, 0 if it doesn't parse. The phone
+   sends no year: a date more than half a year back is taken to be next year's */
+static time_t appt_parse(const char *text) {
+	const char *p = text;
+	int32_t month, day, hour, min;
+	time_t now = time(NULL), at;
+	struct tm tm = *localtime(&now);
+
+	month = appt_number(&p);
+	if((month < 1) || (month > 12) || (*p++ != '/')) return 0;
+	day = appt_number(&p);
+	if((day < 1) || (day > 31) || (*p++ != ' ')) return 0;
+	hour = appt_number(&p);
+	if((hour < 0) || (hour > 23) || (*p++ != ':')) return 0;
+	min = appt_number(&p);
+	if((min < 0) || (min > 59)) return 0;
+
+	tm.tm_mon = month - 1;
+	tm.tm_mday = day;
+	tm.tm_hour = hour;
+	tm.tm_min = min;
+	tm.tm_sec = 0;
+	at = mktime(&tm);
+	if(at < now - APPT_YEAR_WRAP) {
+		tm.tm_year++;
+		at = mktime(&tm);
+	}
+	return at;
+}
+
+/* Show the countdown for now and arm the job for the next time the text changes */
+static void appt_update() {
+	static char countdown[TEXT_DATE_LENGTH + 1];
+	time_t now, end;
+	int32_t delta, minutes;
+
+	sched_cancel(JOB_APPOINTMENT);
+	if(appointment_time[0] == '\0') return;
+
+	now = time(NULL);
+	delta = appointment_at - now;
+	end = cal_queue_count ? appointment_at + (time_t)cal_queue[0].duration * 60 : 0;
+
+	// The queue knows when this one ends, move on without asking the phone. Checked first,
+	// a multi-day or all-day event is long out of the countdown window when it ends
+	if(cal_queue_count && (appointment_at != 0) && (now >= end)) {
+		cal_queue_advance();
+		return;
+	}
+
+	// Unparsed, or too far either way for a countdown: the date as the phone sent it
+	if((appointment_at == 0) || (delta <= -APPT_COUNTDOWN_WINDOW) || (delta > APPT_COUNTDOWN_WINDOW)) {
+		state_set_string(TEXT_CALENDAR_DATE, appointment_time);
+		if((appointment_at != 0) && (delta > APPT_COUNTDOWN_WINDOW))
+			sched_arm(JOB_APPOINTMENT, MIN(delta - APPT_COUNTDOWN_WINDOW, APPT_MAX_SLEEP) * 1000);
+		else if((appointment_at != 0) && cal_queue_count)
+			sched_arm(JOB_APPOINTMENT, MIN(end - now, APPT_MAX_SLEEP) * 1000);
+		return;
+	}
+
+	if(delta > 0) {
+		// Whole minutes left, rounded up so the start reads "Now!"
+		minutes = (delta + 59) / 60;
+		if(minutes >= 60)
+			snprintf(countdown, sizeof(countdown), "In %dh %dm", (int)(minutes / 60), (int)(minutes % 60));
+		else
+			snprintf(countdown, sizeof(countdown), "In %d min", (int)minutes);
+		state_set_string(TEXT_CALENDAR_DATE, countdown);
+
+		if((minutes == APPT_WARNING_MINUTES) && !appt_warned) {
+			appt_warned = true;
+			vibes_short_pulse();
+		}
+		// Next change on the appointment's own minute grid
+		sched_arm(JOB_APPOINTMENT, (((delta - 1) % 60) + 1) * 1000);
+		return;
+	}
+
+	minutes = -delta / 60;
+	if(minutes == 0) {
+		state_set_string(TEXT_CALENDAR_DATE, "Now!");
+		if(!appt_started) {
+			appt_started = true;
+			vibes_double_pulse();
+		}
+	} else if(minutes >= 60) {
+		snprintf(countdown, sizeof(countdown), "%dh %dm in", (int)(minutes / 60), (int)(minutes % 60));
+		state_set_string(TEXT_CALENDAR_DATE, countdown);
+	} else {
+		snprintf(countdown, sizeof(countdown), "%d min in", (int)minutes);
+		state_set_string(TEXT_CALENDAR_DATE, countdown);
+	}
+	delta = 60 - ((-delta) % 60);
+	if(cal_queue_count)
+		delta = MIN(delta, end - now);
+	sched_arm(JOB_APPOINTMENT, delta * 1000);
+}
+
+static void appt_set_time(time_t at) {
+	if(at != appointment_at) {
+		appointment_at = at;
+		appt_warned = appt_started = false;
+	}
+	appt_update();
+}
+
+/* A new appointment text, converted once so the countdown needs no parsing */
+static void appt_set(const char *text, size_t length) {
+	length = MIN(length, sizeof(appointment_time) - 1);
+	memcpy(appointment_time, text, length);
+	appointment_time[length] = '\0';
+
+	// A single appointment from the phone replaces whatever the queue held
+	cal_queue_count = 0;
+	cal_queue_active = false;
+	appt_set_time(appt_parse(appointment_time));
+}
+
+static AppMessageResult sm_message_out_get(DictionaryIterator **iter_out) {
+    AppMessageResult result = app_message_outbox_begin(iter_out);
+    if(result != APP_MSG_OK) return result;
+    dict_write_int32(*iter_out, SM_SEQUENCE_NUMBER_KEY, ++s_sequence_number);
+    if(s_sequence_number == 0xFFFFFFFF) {
+        s_sequence_number = 1;
+    }
+    return APP_MSG_OK;
+}
+
+static void reset_sequence_number() {
+	TRACE(TRACE_LINK, TRACE_SEQUENCE_RESET, 0, 0);
+
+	// Queued like any refresh so it can't collide with a message in flight
+	outbox_push(SM_SEQUENCE_NUMBER_KEY, 0, OUTBOX_PRIO_REFRESH);
+}
+
+/* Current time in milliseconds, for latency measurements */
+static uint32_t get_time_ms() {
+	time_t seconds;
+	uint16_t millis;
+
+	time_ms(&seconds, &millis);
+	return (uint32_t)seconds * 1000 + millis;
+}
+
+// Trace log
+#if TRACE_LEVEL > 0
+static void trace_record(uint16_t event, uint16_t arg0, uint32_t arg1) {
+	TraceRecord *record = &trace_ring[trace_next];
+
+	record->time = get_time_ms();
+	record->event = event;
+	record->arg0 = arg0;
+	record->arg1 = arg1;
+	if(++trace_next == TRACE_RING_SIZE) {
+		trace_next = 0;
+		trace_wrapped = true;
+	}
+}
+
+static uint8_t trace_count() {
+	return trace_wrapped ? TRACE_RING_SIZE : trace_next;
+}
+
+static const TraceRecord *trace_get(uint8_t index) {
+	return &trace_ring[(trace_wrapped ? trace_next + index : index) % TRACE_RING_SIZE];
+}
+
+/* Oldest first, one line per record */
+static void trace_dump_log() {
+	const TraceRecord *record;
+	uint8_t i;
+
+	for(i = 0; i < trace_count(); i++) {
+		record = trace_get(i);
+		APP_LOG(APP_LOG_LEVEL_INFO, "Trace %u: event %d, %d, %d", (unsigned)record->time, record->event,
+				record->arg0, (int)record->arg1);
+	}
+}
+#endif
+
+// Profiling
+/* One frame is everything an event callback does, nested callbacks count for the outer one */
+static void prof_begin(uint8_t event) {
+	if(!PROFILE || (prof_event != NUM_PROF_EVENTS)) return;
+
+	prof_event = event;
+	memset(&prof_frame, 0, sizeof(prof_frame));
+	prof_started = get_time_ms();
+}
+
+/* A canvas region invalidated. The system still repaints the window, this counts what changed */
+static void prof_mark(GRect frame) {
+	if(!PROFILE || (prof_event == NUM_PROF_EVENTS)) return;
+
+	prof_frame.marks++;
+	prof_frame.pixels += frame.size.w * frame.size.h;
+}
+
+/* Called by our update procs for each graphics call they make */
+static void prof_draw(uint8_t calls) {
+	if(!PROFILE) return;
+
+	prof_frame.draws += calls;
+}
+
+static void prof_end(uint8_t event) {
+	ProfStats *stats;
+	uint32_t elapsed;
+
+	if(!PROFILE || (prof_event != event)) return;
+
+	elapsed = get_time_ms() - prof_started;
+	stats = &prof_stats[event];
+	stats->events++;
+	stats->marks += prof_frame.marks;
+	stats->draws += prof_frame.draws;
+	stats->pixels += prof_frame.pixels;
+	stats->time_total += elapsed;
+	stats->time_max = MAX(stats->time_max, elapsed);
+	prof_event = NUM_PROF_EVENTS;
+
+	APP_LOG(APP_LOG_LEVEL_DEBUG, "Frame %s: %d ms, %d marks, %d px, %d draws", PROF_EVENT_NAMES[event],
+			(int)elapsed, prof_frame.marks, (int)prof_frame.pixels, prof_frame.draws);
+}
+
+static void prof_report() {
+	uint8_t event;
+
+	if(!PROFILE) return;
+
+	for(event = 0; event < NUM_PROF_EVENTS; event++) {
+		if(prof_stats[event].events == 0) continue;
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "Profile %s: %d frames, %d ms total (max %d), %d marks, %d px, %d draws",
+				PROF_EVENT_NAMES[event], prof_stats[event].events, (int)prof_stats[event].time_total,
+				prof_stats[event].time_max, prof_stats[event].marks, (int)prof_stats[event].pixels,
+				prof_stats[event].draws);
+	}
+}
+
+// Link statistics
+/* Slot for a key, claimed on first use. The last slot takes every key once the others are used */
+static LinkKeyStats *link_key(uint32_t key) {
+	uint8_t i, offset = key - SM_KEY_BASE;
+
+	for(i = 0; i < link_stats.keys_used; i++) {
+		if(link_keys[i].key == offset) return &link_keys[i];
+	}
+	if(link_stats.keys_used == LINK_KEY_SLOTS) return &link_keys[LINK_KEY_SLOTS - 1];
+
+	link_keys[i].key = (i == LINK_KEY_SLOTS - 1) ? 0xFF : offset;
+	link_stats.keys_used++;
+	return &link_keys[i];
+}
+
+static uint8_t link_result_index(AppMessageResult result) {
+	uint8_t index = 0;
+
+	while((result >>= 1) && (index < LINK_NUM_RESULTS - 1)) index++;
+	return index;
+}
+
+static uint32_t link_dict_size(const DictionaryIterator *iter) {
+	return (iter && iter->end) ? (uint32_t)((const uint8_t *)iter->end - (const uint8_t *)iter->dictionary) : 0;
+}
+
+static void link_count_sent(uint32_t key) {
+	link_key(key)->sent++;
+}
+
+/* The outbox reports back on the message in flight */
+static void link_count_outcome(uint32_t key, const DictionaryIterator *iter, AppMessageResult result) {
+	LinkKeyStats *stats = link_key(key);
+
+	if(result == APP_MSG_OK) {
+		stats->acked++;
+		stats->bytes_out += link_dict_size(iter);
+	} else {
+		stats->failed++;
+		link_stats.failed[link_result_index(result)]++;
+	}
+}
+
+static void link_count_received(const Tuple *t) {
+	LinkKeyStats *stats = link_key(t->key);
+
+	stats->received++;
+	stats->bytes_in += sizeof(Tuple) + t->length;
+}
+
+static void link_count_dropped(AppMessageResult reason) {
+	link_stats.dropped[link_result_index(reason)]++;
+}
+
+/* Seconds spent in a link state, the current one counts up to now */
+static uint32_t link_time_in(uint8_t state) {
+	uint32_t seconds = link_recovery.time_in[state];
+
+	if(state == link_recovery.state) seconds += time(NULL) - link_recovery.since;
+	return seconds;
 }
 
-/* Convert string to number */
-static int32_t string2number(char *string) {
-	int32_t result;
-	int32_t offset;
-	int32_t digit = -1;
-	int32_t unit = 1;
-	int8_t letter;
+/* Remember when a sequence number went out, replies carrying it close the round trip */
+static void link_track_request(uint32_t sequence) {
+	link_pending[link_pending_next].sequence = sequence;
+	link_pending[link_pending_next].sent_at = get_time_ms();
+	link_pending_next = (link_pending_next + 1) % LINK_PENDING_SLOTS;
+}
+
+/* Buckets double from 64 ms, the last one holds everything slower */
+static void link_match_reply(uint32_t sequence) {
+	uint8_t i, bucket;
+	uint32_t latency;
+
+	for(i = 0; i < LINK_PENDING_SLOTS; i++) {
+		if((link_pending[i].sent_at == 0) || (link_pending[i].sequence != sequence)) continue;
+
+		latency = get_time_ms() - link_pending[i].sent_at;
+		link_pending[i].sent_at = 0;
+		for(bucket = 0; (bucket < LINK_LATENCY_BUCKETS - 1) && (latency >= (64u << bucket)); bucket++);
+		link_stats.latency[bucket]++;
+		link_stats.latency_max = MAX(link_stats.latency_max, latency);
+		return;
+	}
+	link_stats.unmatched++;
+}
+
+static void link_put16(uint8_t **p, uint16_t value) {
+	*(*p)++ = value & 0xFF;
+	*(*p)++ = value >> 8;
+}
+
+static void link_put32(uint8_t **p, uint32_t value) {
+	link_put16(p, value & 0xFFFF);
+	link_put16(p, value >> 16);
+}
+
+/* Everything in one little-endian byte array: version, key count, per key
+   (key offset, sent, acked, failed, received, bytes out, bytes in), failures and
+   drops by result bit, latency buckets, unmatched replies, the slowest reply, then
+   link state, recovery attempts, resyncs and seconds spent in each state */
+static uint16_t link_write_blob(DictionaryIterator *iter) {
+	uint8_t blob[LINK_BLOB_SIZE];
+	uint8_t *p = blob;
+	uint8_t i;
+
+	*p++ = LINK_STATS_VERSION;
+	*p++ = link_stats.keys_used;
+	for(i = 0; i < link_stats.keys_used; i++) {
+		*p++ = link_keys[i].key;
+		link_put16(&p, link_keys[i].sent);
+		link_put16(&p, link_keys[i].acked);
+		link_put16(&p, link_keys[i].failed);
+		link_put16(&p, link_keys[i].received);
+		link_put32(&p, link_keys[i].bytes_out);
+		link_put32(&p, link_keys[i].bytes_in);
+	}
+	for(i = 0; i < LINK_NUM_RESULTS; i++) link_put16(&p, link_stats.failed[i]);
+	for(i = 0; i < LINK_NUM_RESULTS; i++) link_put16(&p, link_stats.dropped[i]);
+	for(i = 0; i < LINK_LATENCY_BUCKETS; i++) link_put16(&p, link_stats.latency[i]);
+	link_put16(&p, link_stats.unmatched);
+	link_put32(&p, link_stats.latency_max);
+	*p++ = link_recovery.state;
+	*p++ = link_recovery.attempts;
+	link_put16(&p, link_recovery.resyncs);
+	for(i = 0; i < NUM_LINK_STATES; i++) link_put32(&p, link_time_in(i));
+
+	if(dict_write_data(iter, SM_LINK_STATS_KEY, blob, p - blob) != DICT_OK) return 0;
+	return p - blob;
+}
+
+#if TRACE_LEVEL > 0
+/* Version, record count, then the records oldest first with the same little-endian fields */
+static uint16_t trace_write_blob(DictionaryIterator *iter) {
+	uint8_t blob[TRACE_BLOB_SIZE];
+	uint8_t *p = blob;
+	const TraceRecord *record;
+	uint8_t i;
+
+	*p++ = TRACE_DUMP_VERSION;
+	*p++ = trace_count();
+	for(i = 0; i < trace_count(); i++) {
+		record = trace_get(i);
+		link_put32(&p, record->time);
+		link_put16(&p, record->event);
+		link_put16(&p, record->arg0);
+		link_put32(&p, record->arg1);
+	}
+
+	if(dict_write_data(iter, SM_TRACE_DUMP_KEY, blob, p - blob) != DICT_OK) return 0;
+	return p - blob;
+}
+#endif
+
+// Traffic recorder
+/* RECORD_BLOCKS persist keys from PERSIST_KEY_RECORD_BLOCK on form a ring, record_head is the
+   block being filled in RAM. Records never straddle blocks, a full one is written out and the
+   ring moves on, so flash only sees a write per block */
+static void record_flush() {
+	if(!record_block || (record_fill == 0)) return;
+	persist_write_data(PERSIST_KEY_RECORD_BLOCK + record_head, record_block, record_fill);
+}
+
+static void record_next_block() {
+	record_flush();
+	record_head = (record_head + 1) % RECORD_BLOCKS;
+	record_fill = 0;
+	persist_write_int(PERSIST_KEY_RECORD_HEAD, record_head);
+}
+
+static uint8_t record_stored(const Tuple *t) {
+	return (RECORD_LEVEL >= 2) ? MIN(t->length, RECORD_PAYLOAD_BYTES) : 0;
+}
+
+/* Length, ms clock, direction, AppMessageResult and tuple count, then per tuple its key offset,
+   type, length and how many value bytes follow. All little-endian */
+static void record_dict(uint8_t direction, DictionaryIterator *iter, uint16_t result) {
+	uint8_t *start, *p;
+	uint16_t size = RECORD_HEADER_SIZE;
+	Tuple *t;
+
+	// The recorder's own traffic stays out
+	if(!record_block) return;
+	if(iter && dict_find(iter, SM_RECORD_KEY)) return;
+
+	for(t = iter ? dict_read_first(iter) : NULL; t != NULL; t = dict_read_next(iter))
+		if(sm_key_known(t->key)) size += RECORD_TUPLE_SIZE + record_stored(t);
+	if(record_fill + size > RECORD_BLOCK_SIZE) record_next_block();
+
+	start = p = record_block + record_fill;
+	p += 2;
+	link_put32(&p, get_time_ms());
+	*p++ = direction;
+	link_put16(&p, result);
+	*p++ = 0;
+	for(t = iter ? dict_read_first(iter) : NULL; t != NULL; t = dict_read_next(iter)) {
+		if(!sm_key_known(t->key)) continue;
+		// Only a message too big for a whole block gets cut short
+		if(p + RECORD_TUPLE_SIZE + record_stored(t) > record_block + RECORD_BLOCK_SIZE) break;
+		*p++ = t->key - SM_KEY_BASE;
+		*p++ = t->type;
+		link_put16(&p, t->length);
+		*p++ = record_stored(t);
+		memcpy(p, t->value->data, record_stored(t));
+		p += record_stored(t);
+		start[RECORD_HEADER_SIZE - 1]++;
+	}
+	start[0] = (p - start) & 0xFF;
+	start[1] = (p - start) >> 8;
+	record_fill = p - record_block;
+}
+
+/* A launch starts on a fresh block, whatever the last one left behind */
+static void record_start() {
+	if(RECORD_LEVEL == 0) return;
+
+	record_block = malloc(RECORD_BLOCK_SIZE);
+	if(!record_block) return;
+	record_head = persist_exists(PERSIST_KEY_RECORD_HEAD) ? persist_read_int(PERSIST_KEY_RECORD_HEAD) % RECORD_BLOCKS : 0;
+	record_next_block();
+	record_dict(RECORD_START, NULL, APP_MSG_OK);
+}
+
+static void record_stop() {
+	if(!record_block) return;
+
+	record_flush();
+	free(record_block);
+	record_block = NULL;
+}
+
+/* Version, block index and the block being filled, then the block as stored */
+static uint16_t record_write_blob(DictionaryIterator *iter, uint8_t block) {
+	uint8_t blob[RECORD_BLOB_SIZE];
+	int length;
+
+	if(!record_block || (block >= RECORD_BLOCKS)) return 0;
+
+	blob[0] = RECORD_VERSION;
+	blob[1] = block;
+	blob[2] = record_head;
+	if(block == record_head) {
+		length = record_fill;
+		memcpy(blob + 3, record_block, length);
+	} else
+		length = MAX(persist_read_data(PERSIST_KEY_RECORD_BLOCK + block, blob + 3, RECORD_BLOCK_SIZE), 0);
+
+	if(dict_write_data(iter, SM_RECORD_KEY, blob, 3 + length) != DICT_OK) return 0;
+	return 3 + length;
+}
+
+static void outbox_remove(uint8_t index) {
+	for(; index + 1 < outbox_count; index++) {
+		outbox_queue[index] = outbox_queue[index + 1];
+	}
+	outbox_count--;
+	outbox_stats.depth = outbox_count;
+}
+
+static bool outbox_insert(uint8_t index, const OutboxEntry *entry) {
+	uint8_t i;
+
+	if(outbox_count >= OUTBOX_QUEUE_SIZE) return false;
+
+	for(i = outbox_count; i > index; i--) {
+		outbox_queue[i] = outbox_queue[i - 1];
+	}
+	outbox_queue[index] = *entry;
+	outbox_count++;
+	outbox_stats.depth = outbox_count;
+	outbox_stats.max_depth = MAX(outbox_stats.max_depth, outbox_count);
+	return true;
+}
+
+static AppMessageResult outbox_send_entry(const OutboxEntry *entry) {
+	DictionaryIterator *iterout = NULL;
+	AppMessageResult result;
+
+	if(entry->key == SM_SEQUENCE_NUMBER_KEY) {
+		// A sequence reset carries nothing else and does not consume a number
+		result = app_message_outbox_begin(&iterout);
+		if(result != APP_MSG_OK) return result;
+		if(!iterout) return APP_MSG_INTERNAL_ERROR;
+		dict_write_int32(iterout, SM_SEQUENCE_NUMBER_KEY, 0xFFFFFFFF);
+	} else {
+		result = sm_message_out_get(&iterout);
+		if(result != APP_MSG_OK) return result;
+		if(!iterout) return APP_MSG_INTERNAL_ERROR;
+		if(entry->key == SM_REFRESH_BATCH_KEY) {
+			if(!refresh_write_batch(iterout, entry->param)) return APP_MSG_INVALID_ARGS;
+		} else if(entry->key == SM_LINK_STATS_KEY) {
+			if(link_write_blob(iterout) == 0) return APP_MSG_INVALID_ARGS;
+#if TRACE_LEVEL > 0
+		} else if(entry->key == SM_TRACE_DUMP_KEY) {
+			if(trace_write_blob(iterout) == 0) return APP_MSG_INVALID_ARGS;
+#endif
+		} else if(entry->key == SM_SUBSCRIBE_KEY) {
+			if(!sub_write_blob(iterout)) return APP_MSG_INVALID_ARGS;
+		} else if(entry->key == SM_TOPIC_SYNC_KEY) {
+			if(!sync_write_blob(iterout)) return APP_MSG_INVALID_ARGS;
+		} else if(entry->key == SM_RECORD_KEY) {
+			if(record_write_blob(iterout, entry->param) == 0) return APP_MSG_INVALID_ARGS;
+		} else {
+			if(dict_write_int8(iterout, entry->key, entry->param) != DICT_OK) return APP_MSG_INVALID_ARGS;
+		}
+	}
+
+	result = app_message_outbox_send();
+	if((result == APP_MSG_OK) && (entry->key != SM_SEQUENCE_NUMBER_KEY))
+		link_track_request(s_sequence_number);
+	return result;
+}
+
+static void outbox_retry_cbk(void *data) {
+	outbox_retry_timer = NULL;
+	outbox_drain();
+}
+
+/* Send the next queued command if the outbox is free: user commands first, FIFO within a class */
+static void outbox_drain() {
+	uint8_t i, next;
+	uint32_t latency;
+	AppMessageResult result;
+
+	if(sending || (outbox_count == 0)) return;
+
+	for(next = 0, i = 1; i < outbox_count; i++) {
+		if(outbox_queue[i].prio < outbox_queue[next].prio) next = i;
+	}
+
+	outbox_in_flight = outbox_queue[next];
+	outbox_remove(next);
+
+	result = outbox_send_entry(&outbox_in_flight);
+	if(result == APP_MSG_BUSY) {
+		// Outbox still held by the system and no callback is coming for it, try again shortly
+		outbox_insert(0, &outbox_in_flight);
+		if(!outbox_retry_timer)
+			outbox_retry_timer = app_timer_register(OUTBOX_BUSY_RETRY, outbox_retry_cbk, NULL);
+		return;
+	}
+	if(result != APP_MSG_OK) {
+		TRACE(TRACE_LINK, TRACE_OUTBOX_DROP, outbox_in_flight.key, result);
+		outbox_drain();
+		return;
+	}
+
+	sending = 1;
+	link_count_sent(outbox_in_flight.key);
+
+	if(outbox_in_flight.prio == OUTBOX_PRIO_USER) {
+		latency = get_time_ms() - outbox_in_flight.queued_at;
+		outbox_stats.user_sent++;
+		outbox_stats.user_latency_last = latency;
+		outbox_stats.user_latency_max = MAX(outbox_stats.user_latency_max, latency);
+		outbox_stats.user_latency_total += latency;
+		if(DEBUG)
+			APP_LOG(APP_LOG_LEVEL_DEBUG, "Outbox: key %d, depth %d, latency %d ms (max %d)",
+					(int)outbox_in_flight.key, outbox_count, (int)latency, (int)outbox_stats.user_latency_max);
+	}
+}
+
+/* Full: a user command evicts the newest refresh, anything else is dropped */
+static bool outbox_make_room(OutboxPriority prio) {
+	uint8_t i;
+
+	if(outbox_count < OUTBOX_QUEUE_SIZE) return true;
+
+	for(i = outbox_count; i > 0; i--) {
+		if(outbox_queue[i - 1].prio == OUTBOX_PRIO_REFRESH) break;
+	}
+	outbox_stats.evicted++;
+	if((prio == OUTBOX_PRIO_REFRESH) || (i == 0)) {
+		if(prio == OUTBOX_PRIO_USER) outbox_stats.user_lost++;
+		return false;
+	}
+	outbox_remove(i - 1);
+	return true;
+}
+
+static void outbox_push(uint32_t key, int8_t param, OutboxPriority prio) {
+	OutboxEntry entry;
+	uint8_t i;
+
+	if(!bluetooth_connection_service_peek()) return;
+
+	// Nothing polls an unreachable phone, a button press still gets through as a probe
+	if((link_recovery.state == LINK_DOWN) && (prio == OUTBOX_PRIO_REFRESH)) return;
+
+	// A refresh already waiting covers this one, batches merge their topics
+	if(prio == OUTBOX_PRIO_REFRESH) {
+		for(i = 0; i < outbox_count; i++) {
+			if((outbox_queue[i].key == SM_REFRESH_BATCH_KEY) && (key == SM_REFRESH_BATCH_KEY)) {
+				outbox_queue[i].param |= param;
+				outbox_stats.coalesced++;
+				return;
+			}
+			if((outbox_queue[i].key == key) && (outbox_queue[i].param == param)) {
+				outbox_stats.coalesced++;
+				return;
+			}
+		}
+	}
+
+	if(!outbox_make_room(prio)) return;
+
+	entry.key = key;
+	entry.param = param;
+	entry.prio = prio;
+	entry.retries = 0;
+	entry.queued_at = get_time_ms();
+	outbox_insert(outbox_count, &entry);
+
+	outbox_drain();
+}
+
+static void sendCommand(int key) {
+	TRACE(TRACE_VERBOSE, TRACE_SEND, key, -1);
+	outbox_push(key, -1, OUTBOX_PRIO_USER);
+
+	if((key == SM_PLAYPAUSE_KEY) || (key == SM_NEXT_TRACK_KEY) || (key == SM_PREVIOUS_TRACK_KEY))
+		music_command(key);
+}
+
+static void sendCommandInt(int key, int param) {
+	TRACE(TRACE_VERBOSE, TRACE_SEND, key, param);
+	outbox_push(key, param, OUTBOX_PRIO_USER);
+}
+
+static void sendRefresh(int key) {
+	outbox_push(key, -1, OUTBOX_PRIO_REFRESH);
+}
+
+static void sendRefreshInt(int key, int param) {
+	outbox_push(key, param, OUTBOX_PRIO_REFRESH);
+}
+
+// Scheduled jobs
+static void timer_cbk_weather() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_WEATHER, 0);
+
+	governor_arm(TOPIC_WEATHER, refresh_interval(TOPIC_WEATHER));
+
+	refresh_request(TOPIC_WEATHER);
+}
+		
+static void timer_cbk_calandar() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_CALANDAR, 0);
+
+	governor_arm(TOPIC_CALENDAR, refresh_interval(TOPIC_CALENDAR));
+
+	refresh_request(TOPIC_CALENDAR);
+}
+
+static void timer_cbk_music() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_MUSIC, 0);
+
+	// Fallback poll in case the answer is lost, none at all while paused
+	governor_arm(TOPIC_MUSIC, refresh_interval(TOPIC_MUSIC));
+
+	refresh_request(TOPIC_MUSIC);
+}
+
+static void timer_cbk_layerswap() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_LAYERSWAP, 0);
+
+	swap_bottom_layer();	
+
+	//sched_arm(JOB_LAYERSWAP, SWAP_BOTTOM_LAYER_INTERVAL);
+}
+	
+static void timer_cbk_nextdayweather() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_NEXTDAYWEATHER, 0);
+	
+	refresh_request(TOPIC_WEATHER);
+}
+		
+static void timer_cbk_gps() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_GPS, 0);
+
+	refresh_request(TOPIC_GPS);
+		
+	governor_arm(TOPIC_GPS, refresh_interval(TOPIC_GPS));
+}
+	
+// Link state
+static void link_set_state(uint8_t state) {
+	time_t now = time(NULL);
+
+	if(state == link_recovery.state) return;
+
+	link_recovery.time_in[link_recovery.state] += now - link_recovery.since;
+	link_recovery.since = now;
+	TRACE(TRACE_LINK, TRACE_LINK_STATE, state, link_recovery.attempts);
+	link_recovery.state = state;
+}
+
+/* Doubles per attempt up to the cap, +/- 25% so watches don't probe in lockstep */
+static int32_t link_backoff() {
+	int32_t delay = RECOVERY_BACKOFF_MIN;
+	uint8_t i;
+
+	for(i = 1; (i < link_recovery.attempts) && (delay < RECOVERY_BACKOFF_MAX); i++) delay *= 2;
+	delay = MIN(delay, RECOVERY_BACKOFF_MAX);
+	return delay - delay / 4 + rand() % (delay / 2 + 1);
+}
+
+/* Ask for the status screen again, resetting the sequence only if the phone lost track of it */
+static void link_probe() {
+	if(link_recovery.desync) {
+		link_recovery.desync = false;
+		link_recovery.resyncs++;
+		reset_sequence_number();
+	}
+	sendRefreshInt(SM_SCREEN_ENTER_KEY, STATUS_SCREEN_APP);
+}
+
+/* Anything acked or received */
+static void link_ok() {
+	uint8_t previous = link_recovery.state;
+
+	link_recovery.attempts = 0;
+	link_recovery.failures = 0;
+	sched_cancel(JOB_CONNECTIONRECOVER);
+	link_set_state(LINK_CONNECTED);
+
+	// Refreshes were dropped while down, ask for what went stale in one batch
+	if((previous == LINK_DOWN) && !topic_sync.active)
+		governor_catch_up(governor_sync());
+}
+
+/* Stop probing until Bluetooth comes back or a button press gets through */
+static void link_down() {
+	sched_cancel(JOB_CONNECTIONRECOVER);
+	link_set_state(LINK_DOWN);
+}
+
+/* Busy, timeouts and dropped inbound messages: retry quietly before calling it a loss */
+static void link_transient(AppMessageResult reason) {
+	if(link_recovery.state == LINK_DOWN) return;
+
+	if(++link_recovery.failures < LINK_DEGRADED_FAILURES) {
+		if(link_recovery.state == LINK_CONNECTED)
+			link_set_state(LINK_DEGRADED);
+		return;
+	}
+
+	if(link_recovery.state != LINK_RECOVERING) {
+		link_set_state(LINK_RECOVERING);
+		sched_arm(JOB_CONNECTIONRECOVER, link_backoff());
+	}
+}
+
+/* Not connected, app not running or rejected: probe with backoff, a rejection also means a resync */
+static void link_hard(AppMessageResult reason) {
+	if(reason == APP_MSG_SEND_REJECTED)
+		link_recovery.desync = true;
+
+	if(!bluetooth_connection_service_peek()) {
+		link_down();
+		return;
+	}
+
+	if(link_recovery.state == LINK_DOWN) return;
+
+	if(link_recovery.state != LINK_RECOVERING) {
+		link_recovery.desync |= (reason == APP_MSG_APP_NOT_RUNNING);
+		link_set_state(LINK_RECOVERING);
+		sched_arm(JOB_CONNECTIONRECOVER, link_backoff());
+	}
+}
+
+/* Bluetooth came back, start over with a prompt probe */
+static void link_reconnected() {
+	link_recovery.attempts = 0;
+	link_recovery.failures = 0;
+	link_set_state(LINK_RECOVERING);
+	link_probe();
+}
+
+static void timer_cbk_connectionrecover() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_CONNECTIONRECOVER, 0);
+
+	// After that long the phone app has likely restarted and forgotten our sequence
+	if(++link_recovery.attempts > RECOVERY_MAX_ATTEMPTS) {
+		link_recovery.desync = true;
+		link_down();
+		return;
+	}
+	sched_arm(JOB_CONNECTIONRECOVER, link_backoff());
+	link_probe();
+}
+
+static void timer_cbk_appointment() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_APPOINTMENT, 0);
+
+	appt_update();
+	state_flush();
+}
+
+static void timer_cbk_musicbar() {
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_MUSICBAR, 0);
+
+	music_progress_update();
+	state_flush();
+}
+
+// Scheduler
+static SchedJob sched_jobs[NUM_JOBS] = {
+	[JOB_WEATHER] = {timer_cbk_weather, 0, false, false},
+	[JOB_CALANDAR] = {timer_cbk_calandar, 0, false, false},
+	[JOB_MUSIC] = {timer_cbk_music, 0, false, false},
+	[JOB_LAYERSWAP] = {timer_cbk_layerswap, 0, false, false},
+	[JOB_NEXTDAYWEATHER] = {timer_cbk_nextdayweather, 0, false, false},
+	[JOB_GPS] = {timer_cbk_gps, 0, false, false},
+	[JOB_CONNECTIONRECOVER] = {timer_cbk_connectionrecover, 0, false, true},
+	[JOB_APPOINTMENT] = {timer_cbk_appointment, 0, false, false},
+	[JOB_SYNC] = {timer_cbk_sync, 0, false, false},
+	[JOB_MUSICBAR] = {timer_cbk_musicbar, 0, false, false},
+};
+
+static AppTimer *timerScheduler = NULL;
+static bool sched_running = false;
+
+/* Keep the single wake-up timer on the earliest job the minute tick won't cover */
+static void sched_update_timer() {
+	time_t now, next_tick, earliest;
+	uint8_t i;
+
+	if(sched_running) return;
+
+	now = time(NULL);
+	next_tick = now - (now % 60) + 60;
+	earliest = next_tick;
+	for(i = 0; i < NUM_JOBS; i++) {
+		if(sched_jobs[i].armed && (sched_jobs[i].due < earliest)) earliest = sched_jobs[i].due;
+	}
+
+	if(earliest >= next_tick) {
+		if(timerScheduler) {
+			app_timer_cancel(timerScheduler);
+			timerScheduler = NULL;
+		}
+		return;
+	}
+
+	earliest = MAX(earliest - now, 0);
+	if(!timerScheduler || !app_timer_reschedule(timerScheduler, earliest * 1000))
+		timerScheduler = app_timer_register(earliest * 1000, sched_timer_cbk, NULL);
+}
+
+/* Run every job that is due, or close enough to share this wake-up */
+static void sched_run_due() {
+	time_t now;
+	uint8_t i;
+
+	now = time(NULL);
+	sched_running = true;
+	for(i = 0; i < NUM_JOBS; i++) {
+		if(sched_jobs[i].armed && (sched_jobs[i].due <= now + (sched_jobs[i].exact ? 0 : SCHED_SLACK))) {
+			sched_jobs[i].armed = false;
+			sched_jobs[i].callback();
+		}
+	}
+	sched_running = false;
+
+	refresh_flush();
+	sched_update_timer();
+}
+
+static void sched_timer_cbk(void *data) {
+	prof_begin(PROF_TIMER);
+	timerScheduler = NULL;
+	sched_run_due();
+	prof_end(PROF_TIMER);
+}
+
+static void sched_arm(uint8_t job, int32_t interval) {
+	time_t now, due;
+
+	now = time(NULL);
+	if(sched_jobs[job].exact) {
+		// Round up, plus the part of this second already gone
+		due = now + (interval + 999) / 1000 + 1;
+	} else {
+		due = now + MAX(interval / 1000, 1);
+	}
+
+	// A minute or more away: snap to the nearest minute tick so jobs wake together
+	if((interval >= 60000) && !sched_jobs[job].exact) {
+		due = (due + 30) - ((due + 30) % 60);
+		if(due <= now) due += 60;
+	}
+
+	sched_jobs[job].due = due;
+	sched_jobs[job].armed = true;
+	sched_update_timer();
+}
+
+static void sched_cancel(uint8_t job) {
+	sched_jobs[job].armed = false;
+	sched_update_timer();
+}
+
+static void sched_cancel_all() {
+	uint8_t i;
+
+	for(i = 0; i < NUM_JOBS; i++) {
+		sched_jobs[i].armed = false;
+	}
+	if(timerScheduler) {
+		app_timer_cancel(timerScheduler);
+		timerScheduler = NULL;
+	}
+}
+
+// Refresh requests
+static const uint32_t REFRESH_TOPIC_KEYS[NUM_TOPICS] = {
+	SM_STATUS_UPD_WEATHER_KEY,
+	SM_STATUS_UPD_CAL_KEY,
+	SM_SONG_LENGTH_KEY,
+	0
+};
+
+/* Screen context each topic needs when requested on its own */
+static const int8_t REFRESH_TOPIC_APPS[NUM_TOPICS] = {
+	WEATHER_APP,
+	STATUS_SCREEN_APP,
+	STATUS_SCREEN_APP,
+	GPS_APP
+};
+
+static uint8_t refresh_pending = 0;
+static RefreshStats refresh_stats;
+
+/* Batches only once the phone answered the probe with SM_REFRESH_BATCH_KEY, until then
+   each topic goes out with its own request and screen context */
+static bool refresh_batch_active = false;
+static bool refresh_batch_probed = false;
+
+/* Write every requested topic and the status screen context into one message */
+static bool refresh_write_batch(DictionaryIterator *iter, uint8_t topics) {
+	uint8_t i;
+
+	// No topics is the probe, the key alone so a phone that does not batch just ignores it
+	if(topics == 0)
+		return dict_write_uint8(iter, SM_REFRESH_BATCH_KEY, 0) == DICT_OK;
+
+	if(dict_write_int8(iter, SM_SCREEN_ENTER_KEY, STATUS_SCREEN_APP) != DICT_OK) return false;
+	if(dict_write_uint8(iter, SM_REFRESH_BATCH_KEY, topics) != DICT_OK) return false;
+	for(i = 0; i < NUM_TOPICS; i++) {
+		if(!(topics & (1 << i))) continue;
+
+		// What this topic costs when requested on its own
+		refresh_stats.topics++;
+		refresh_stats.legacy_messages += (REFRESH_TOPIC_KEYS[i] != 0) ? 2 : 1;
+
+		if(REFRESH_TOPIC_KEYS[i] == 0) continue;
+		if(dict_write_int8(iter, REFRESH_TOPIC_KEYS[i], -1) != DICT_OK) return false;
+
+		// Tell the phone how many events we can hold, one that knows answers with SM_CAL_QUEUE_KEY
+		if((i == TOPIC_CALENDAR) && (dict_write_uint8(iter, SM_CAL_QUEUE_KEY, CAL_QUEUE_SIZE) != DICT_OK))
+			return false;
+		// Same for the weather record version we decode
+		if((i == TOPIC_WEATHER) && (dict_write_uint8(iter, SM_WEATHER_DATA_KEY, WEATHER_RECORD_VERSION) != DICT_OK))
+			return false;
+	}
+	refresh_stats.batches++;
+
+	if(DEBUG)
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "Refresh: %d messages for %d topics, %d unbatched",
+				refresh_stats.batches, refresh_stats.topics, refresh_stats.legacy_messages);
+	return true;
+}
+
+static void refresh_flush() {
+	uint8_t i;
+
+	if(refresh_pending == 0) return;
+
+	if(BATCHED_REFRESH && refresh_batch_active) {
+		sendRefreshInt(SM_REFRESH_BATCH_KEY, refresh_pending);
+	} else {
+		if(BATCHED_REFRESH && !refresh_batch_probed) {
+			refresh_batch_probed = true;
+			sendRefreshInt(SM_REFRESH_BATCH_KEY, 0);
+		}
+		for(i = 0; i < NUM_TOPICS; i++) {
+			if(!(refresh_pending & (1 << i))) continue;
+			if((current_app != REFRESH_TOPIC_APPS[i]) || (REFRESH_TOPIC_KEYS[i] == 0))
+				sendRefreshInt(SM_SCREEN_ENTER_KEY, REFRESH_TOPIC_APPS[i]);
+			if(REFRESH_TOPIC_KEYS[i] != 0)
+				sendRefresh(REFRESH_TOPIC_KEYS[i]);
+		}
+	}
+	refresh_pending = 0;
+}
+
+/* Topics requested while the scheduler runs go out together once it is done */
+static void refresh_request(uint8_t topic) {
+	refresh_pending |= (1 << topic);
+	if(!sched_running)
+		refresh_flush();
+}
+
+// Subscriptions
+/* Smallest change worth a push, in the topic's unit: degrees, meters, percent. 0 is any change */
+static const uint16_t SUB_THRESHOLDS[NUM_SUBS] = {
+	[TOPIC_WEATHER]		= 1,
+	[TOPIC_CALENDAR]	= 0,
+	[TOPIC_MUSIC]		= 0,
+	[TOPIC_GPS]			= 200,
+	[SUB_BATTERY]		= 5,
+};
+
+/* Version and count, then per topic its RefreshTopics index (SUB_BATTERY for the phone
+   battery) and threshold as little-endian uint16 */
+static bool sub_write_blob(DictionaryIterator *iter) {
+	uint8_t blob[SUB_BLOB_SIZE], *p = blob + 2;
+	uint8_t i;
+
+	blob[0] = SUB_VERSION;
+	blob[1] = NUM_SUBS;
+	for(i = 0; i < NUM_SUBS; i++, p += SUB_ENTRY_SIZE) {
+		p[0] = i;
+		p[1] = SUB_THRESHOLDS[i] & 0xFF;
+		p[2] = SUB_THRESHOLDS[i] >> 8;
+	}
+	return dict_write_data(iter, SM_SUBSCRIBE_KEY, blob, sizeof(blob)) == DICT_OK;
+}
+
+/* Polling carries on as before until the phone accepts */
+static void sub_request() {
+	sub_active = 0;
+	sendRefresh(SM_SUBSCRIBE_KEY);
+}
+
+// Music progress
+static int32_t music_elapsed() {
+	int32_t elapsed = music_progress.elapsed;
+
+	if(music_progress.state == MUSIC_PLAYING) elapsed += time(NULL) - music_progress.at;
+	return MIN(elapsed, music_progress.duration);
+}
+
+/* Until the predicted end of the track, 0 while nothing plays. Past the end the answer
+   got lost and the plain poll takes over */
+static int32_t music_refresh_interval() {
+	int32_t left;
+
+	if((music_progress.state != MUSIC_PLAYING) || (music_progress.duration == 0)) return 0;
+	left = music_progress.duration - music_elapsed();
+	return (left > 0) ? (left + MUSIC_END_SLACK) * 1000 : updateMusicInterval;
+}
+
+/* Only redraws when the bar gains a pixel, and wakes up again when the next one is due as long
+   as the music panel shows. Swapping to the panel brings the bar up to date */
+static void music_progress_update() {
+	int32_t elapsed = 0, width = 0, next;
+
+	if(music_progress.duration) {
+		elapsed = music_elapsed();
+		width = elapsed * MUSIC_BAR_WIDTH / music_progress.duration;
+	}
+	state_set_int(FIELD_MUSIC_PROGRESS, &status_state.music_progress, width);
+
+	if((music_progress.state != MUSIC_PLAYING) || (music_progress.duration == 0) || (width >= MUSIC_BAR_WIDTH) ||
+			!panel_shown(MUSIC_LAYER)) {
+		sched_cancel(JOB_MUSICBAR);
+		return;
+	}
+
+	// First whole second the bar is a pixel longer
+	next = ((width + 1) * music_progress.duration + MUSIC_BAR_WIDTH - 1) / MUSIC_BAR_WIDTH;
+	sched_arm(JOB_MUSICBAR, MAX(next - elapsed, 1) * 1000);
+}
+
+/* The phone's answer will tell the new track and state, meanwhile flip the bar locally */
+static void music_command(int key) {
+	if(!music_progress_active) return;
+
+	if(key == SM_PLAYPAUSE_KEY) {
+		music_progress.elapsed = music_elapsed();
+		music_progress.at = time(NULL);
+		music_progress.state = (music_progress.state == MUSIC_PLAYING) ? MUSIC_PAUSED : MUSIC_PLAYING;
+		music_progress_update();
+	}
+	sched_arm(JOB_MUSIC, MUSIC_COMMAND_DELAY);
+}
+
+// Sparklines
+static void spark_clear(Sparkline *spark) {
+	memset(spark, 0, sizeof(*spark));
+}
+
+/* Sample ago samples back from the newest one */
+static uint8_t spark_sample(const Sparkline *spark, uint16_t ago) {
+	return spark->samples[(spark->head + SPARK_SAMPLES - 1 - ago) % SPARK_SAMPLES];
+}
+
+static uint8_t spark_row(const Sparkline *spark, uint8_t value) {
+	return (SPARK_HEIGHT - 1) - (value - spark->low) * (SPARK_HEIGHT - 1) / MAX(spark->high - spark->low, 1);
+}
+
+/* New sample into the ring and the newest column, a full column shifts the others left */
+static void spark_append(Sparkline *spark, uint8_t value) {
+	spark->samples[spark->head] = value;
+	spark->head = (spark->head + 1) % SPARK_SAMPLES;
+	if(spark->count < SPARK_SAMPLES) spark->count++;
+	spark->seq++;
+
+	if((spark->columns == 0) || (spark->bucket_fill == SPARK_BUCKET)) {
+		if(spark->columns == SPARK_COLUMNS)
+			memmove(spark->rows, spark->rows + 1, SPARK_COLUMNS - 1);
+		else
+			spark->columns++;
+		spark->bucket_fill = 0;
+	}
+	spark->bucket_fill++;
+	spark->rows[spark->columns - 1] = spark_row(spark, value);
+}
+
+/* Scale to what the ring holds. Only a changed range redoes every column */
+static void spark_rescale(Sparkline *spark) {
+	uint8_t low = 0xFF, high = 0, value;
+	uint16_t i, ago;
+
+	for(i = 0; i < spark->count; i++) {
+		value = spark_sample(spark, i);
+		low = MIN(low, value);
+		high = MAX(high, value);
+	}
+	if((low == spark->low) && (high == spark->high)) return;
+
+	spark->low = low;
+	spark->high = high;
+	for(i = 0; i < spark->columns; i++) {
+		ago = (i == 0) ? 0 : spark->bucket_fill + (i - 1) * SPARK_BUCKET;
+		spark->rows[spark->columns - 1 - i] = spark_row(spark, spark_sample(spark, MIN(ago, spark->count - 1)));
+	}
+}
+
+// Warm-start cache
+static const uint8_t REFRESH_TOPIC_JOBS[NUM_TOPICS] = {
+	JOB_WEATHER,
+	JOB_CALANDAR,
+	JOB_MUSIC,
+	JOB_GPS
+};
+
+static int32_t * const REFRESH_TOPIC_INTERVALS[NUM_TOPICS] = {
+	&updateWeatherInterval,
+	&updateCalandarInterval,
+	&updateMusicInterval,
+	&updateGPSInterval
+};
+
+/* Percent of the GPS interval per activity, 0 stops asking for a location that can't change */
+static const uint8_t ACTIVITY_GPS_PERCENT[NUM_ACTIVITIES] = {
+	[ACTIVITY_STILL]	= 0,
+	[ACTIVITY_WALKING]	= 100,
+	[ACTIVITY_VEHICLE]	= 50,
+};
+
+/* With the phone keeping a queue of events the calendar only needs an occasional resync, music
+   is asked for again when the track should have ended and location as often as the wrist moves.
+   A pushed topic is only polled as a keep-alive, what can't change isn't polled at all */
+static int32_t refresh_interval(uint8_t topic) {
+	int32_t interval = *REFRESH_TOPIC_INTERVALS[topic];
+
+	if((topic == TOPIC_CALENDAR) && cal_queue_active)
+		interval = MAX(updateCalandarInterval, CAL_QUEUE_RESYNC_INTERVAL);
+	else if((topic == TOPIC_MUSIC) && music_progress_active)
+		interval = music_refresh_interval();
+	else if(topic == TOPIC_GPS)
+		interval = updateGPSInterval * ACTIVITY_GPS_PERCENT[activity.state] / 100;
+
+	if((sub_active & (1 << topic)) && (interval > 0))
+		interval = MAX(interval, SUB_KEEPALIVE);
+	return interval;
+}
+
+static time_t cache_updated[NUM_CACHES];
+static uint8_t cache_dirty = 0;
+
+/* Interval multiplier per tier and topic, 0 pauses the topic */
+static const uint8_t GOVERNOR_SCALE[NUM_TIERS][NUM_TOPICS] = {
+	[TIER_NORMAL]	= {1, 1, 1, 1},
+	[TIER_SAVER]	= {2, 2, 3, 4},
+	[TIER_CRITICAL]	= {4, 4, 0, 0},
+	[TIER_NIGHT]	= {4, 2, 0, 0},
+};
+
+static uint8_t governor_tier = TIER_NORMAL;
+static time_t governor_last_motion = 0;
+static CacheQuietHours quiet_hours = {QUIET_HOURS_START, QUIET_HOURS_END};
+
+/* Data for this category just arrived from the phone, changed or not */
+static void cache_touch(uint8_t cache) {
+	cache_updated[cache] = time(NULL);
+	cache_dirty |= (1 << cache);
+	if(cache < NUM_TOPICS)
+		sync_arrived(cache);
+}
+
+/* Cut on a character boundary like text_store */
+static void cache_copy(char *dst, size_t size, const char *src) {
+	size_t length = strlen(src);
+
+	if(length > size - 1) {
+		length = size - 1;
+		while((length > 0) && ((src[length] & 0xC0) == 0x80)) length--;
+	}
+	memcpy(dst, src, length);
+	dst[length] = '\0';
+}
+
+static void cache_load() {
+	CacheWeather weather;
+	CacheCalendar calendar;
+	CacheMusic music;
+	CacheLocation location;
+	CacheBattery battery;
+	CacheIntervals intervals;
+	CacheQuietHours quiet;
+
+	if(persist_read_int(PERSIST_KEY_VERSION) != PERSIST_VERSION) return;
+
+	if(persist_read_data(PERSIST_KEY_QUIET_HOURS, &quiet, sizeof(quiet)) == sizeof(quiet)) {
+		if((quiet.start < 24) && (quiet.end < 24)) quiet_hours = quiet;
+	}
+
+	if(persist_read_data(PERSIST_KEY_INTERVALS, &intervals, sizeof(intervals)) == sizeof(intervals)) {
+		if(intervals.weather > 0) updateWeatherInterval = intervals.weather;
+		if(intervals.calendar > 0) updateCalandarInterval = intervals.calendar;
+		if(intervals.gps > 0) updateGPSInterval = intervals.gps;
+	}
+
+	if(persist_read_data(PERSIST_KEY_WEATHER, &weather, sizeof(weather)) == sizeof(weather)) {
+		weather.temp[sizeof(weather.temp) - 1] = '\0';
+		weather.tomorrow_temp[sizeof(weather.tomorrow_temp) - 1] = '\0';
+		state_set_string(TEXT_WEATHER_TEMP, weather.temp);
+		state_set_string(TEXT_TOMORROW_TEMP, weather.tomorrow_temp);
+		if(weather.icon < NUM_WEATHER_IMAGES)
+			state_set_int(FIELD_WEATHER_ICON, &status_state.weather_icon, weather.icon);
+		if(weather.tomorrow_icon < NUM_WEATHER_IMAGES)
+			state_set_int(FIELD_TOMORROW_ICON, &status_state.tomorrow_icon, weather.tomorrow_icon);
+		cache_updated[CACHE_WEATHER] = weather.updated;
+	}
+
+	if(persist_read_data(PERSIST_KEY_CALENDAR, &calendar, sizeof(calendar)) == sizeof(calendar)) {
+		calendar.time[sizeof(calendar.time) - 1] = '\0';
+		calendar.text[sizeof(calendar.text) - 1] = '\0';
+		state_set_string(TEXT_CALENDAR_TEXT, calendar.text);
+		appt_set(calendar.time, strlen(calendar.time));
+		cache_updated[CACHE_CALENDAR] = calendar.updated;
+	}
+
+	if(persist_read_data(PERSIST_KEY_MUSIC, &music, sizeof(music)) == sizeof(music)) {
+		music.artist[sizeof(music.artist) - 1] = '\0';
+		music.title[sizeof(music.title) - 1] = '\0';
+		state_set_string(TEXT_MUSIC_ARTIST, music.artist);
+		state_set_string(TEXT_MUSIC_TITLE, music.title);
+		cache_updated[CACHE_MUSIC] = music.updated;
+	}
+
+	if(persist_read_data(PERSIST_KEY_LOCATION, &location, sizeof(location)) == sizeof(location)) {
+		location.street[sizeof(location.street) - 1] = '\0';
+		state_set_string(TEXT_LOCATION, location.street);
+		cache_updated[CACHE_LOCATION] = location.updated;
+	}
+
+	if(persist_read_data(PERSIST_KEY_BATTERY, &battery, sizeof(battery)) == sizeof(battery)) {
+		state_set_int(FIELD_PHONE_BATTERY, &status_state.phone_battery, battery.percent);
+		cache_updated[CACHE_BATTERY] = battery.updated;
+	}
+}
+
+/* Write back only the categories the phone sent since launch */
+static void cache_save() {
+	CacheWeather weather;
+	CacheCalendar calendar;
+	CacheMusic music;
+	CacheLocation location;
+	CacheBattery battery;
+	CacheIntervals intervals;
+
+	if(cache_dirty == 0) return;
+
+	if(persist_read_int(PERSIST_KEY_VERSION) != PERSIST_VERSION)
+		persist_write_int(PERSIST_KEY_VERSION, PERSIST_VERSION);
+
+	if(cache_dirty & (1 << CACHE_WEATHER)) {
+		weather.updated = cache_updated[CACHE_WEATHER];
+		cache_copy(weather.temp, sizeof(weather.temp), text_get(TEXT_WEATHER_TEMP));
+		cache_copy(weather.tomorrow_temp, sizeof(weather.tomorrow_temp), text_get(TEXT_TOMORROW_TEMP));
+		weather.icon = status_state.weather_icon;
+		weather.tomorrow_icon = status_state.tomorrow_icon;
+		persist_write_data(PERSIST_KEY_WEATHER, &weather, sizeof(weather));
+	}
+
+	if(cache_dirty & (1 << CACHE_CALENDAR)) {
+		calendar.updated = cache_updated[CACHE_CALENDAR];
+		cache_copy(calendar.time, sizeof(calendar.time), appointment_time);
+		cache_copy(calendar.text, sizeof(calendar.text), text_get(TEXT_CALENDAR_TEXT));
+		persist_write_data(PERSIST_KEY_CALENDAR, &calendar, sizeof(calendar));
+	}
+
+	if(cache_dirty & (1 << CACHE_MUSIC)) {
+		music.updated = cache_updated[CACHE_MUSIC];
+		cache_copy(music.artist, sizeof(music.artist), text_get(TEXT_MUSIC_ARTIST));
+		cache_copy(music.title, sizeof(music.title), text_get(TEXT_MUSIC_TITLE));
+		persist_write_data(PERSIST_KEY_MUSIC, &music, sizeof(music));
+	}
+
+	if(cache_dirty & (1 << CACHE_LOCATION)) {
+		location.updated = cache_updated[CACHE_LOCATION];
+		cache_copy(location.street, sizeof(location.street), text_get(TEXT_LOCATION));
+		persist_write_data(PERSIST_KEY_LOCATION, &location, sizeof(location));
+	}
+
+	if(cache_dirty & (1 << CACHE_BATTERY)) {
+		battery.updated = cache_updated[CACHE_BATTERY];
+		battery.percent = status_state.phone_battery;
+		persist_write_data(PERSIST_KEY_BATTERY, &battery, sizeof(battery));
+	}
+
+	if(cache_dirty & (1 << CACHE_INTERVALS)) {
+		intervals.weather = updateWeatherInterval;
+		intervals.calendar = updateCalandarInterval;
+		intervals.gps = updateGPSInterval;
+		persist_write_data(PERSIST_KEY_INTERVALS, &intervals, sizeof(intervals));
+	}
+
+	if(cache_dirty & (1 << CACHE_QUIET_HOURS))
+		persist_write_data(PERSIST_KEY_QUIET_HOURS, &quiet_hours, sizeof(quiet_hours));
+
+	cache_dirty = 0;
+}
+
+// Power governor
+static bool governor_quiet_hours(const struct tm *t) {
+	if(quiet_hours.start == quiet_hours.end) return false;
+	if(quiet_hours.start < quiet_hours.end)
+		return (t->tm_hour >= quiet_hours.start) && (t->tm_hour < quiet_hours.end);
+	return (t->tm_hour >= quiet_hours.start) || (t->tm_hour < quiet_hours.end);
+}
+
+/* On the charger nothing is throttled, otherwise the lowest battery or the longest idle wins */
+static uint8_t governor_pick_tier() {
+	BatteryChargeState battery = battery_state_service_peek();
+	time_t now = time(NULL);
+	bool idle = (now - governor_last_motion) >= GOVERNOR_IDLE_TIME;
+
+	if(battery.is_charging || battery.is_plugged) return TIER_NORMAL;
+	if(battery.charge_percent <= GOVERNOR_CRITICAL_PERCENT) return TIER_CRITICAL;
+	if(idle && governor_quiet_hours(localtime(&now))) return TIER_NIGHT;
+	if(idle || (battery.charge_percent <= GOVERNOR_SAVER_PERCENT)) return TIER_SAVER;
+	return TIER_NORMAL;
+}
+
+/* Arm a topic's job for its interval as the current tier sees it */
+static void governor_arm(uint8_t topic, int32_t interval) {
+	uint8_t scale = GOVERNOR_SCALE[governor_tier][topic];
+
+	// A zero interval means the topic has nothing to poll for right now
+	if((scale == 0) || (interval == 0)) {
+		sched_cancel(REFRESH_TOPIC_JOBS[topic]);
+		return;
+	}
+	sched_arm(REFRESH_TOPIC_JOBS[topic], interval * scale);
+}
+
+/* Re-arm every topic for what is left of its interval, returns the topics already overdue */
+static uint8_t governor_sync() {
+	time_t now, age;
+	uint8_t topic, scale, stale = 0;
+	int32_t interval;
+
+	now = time(NULL);
+	for(topic = 0; topic < NUM_TOPICS; topic++) {
+		scale = GOVERNOR_SCALE[governor_tier][topic];
+		interval = refresh_interval(topic) * scale;
+		if(interval == 0) {
+			sched_cancel(REFRESH_TOPIC_JOBS[topic]);
+			continue;
+		}
+
+		age = now - cache_updated[topic];
+		if((cache_updated[topic] == 0) || (age < 0) || (age * 1000 >= interval)) {
+			stale |= (1 << topic);
+			sched_arm(REFRESH_TOPIC_JOBS[topic], interval);
+		} else {
+			sched_arm(REFRESH_TOPIC_JOBS[topic], interval - (int32_t)age * 1000);
+		}
+	}
+	return stale;
+}
+
+/* Overdue topics go out in a single batch */
+static void governor_catch_up(uint8_t stale) {
+	TRACE(TRACE_JOBS, TRACE_TIER, governor_tier, stale);
+
+	// Forecast comes in a second weather answer, unless the phone sends the binary record
+	if((stale & (1 << TOPIC_WEATHER)) && !weather_record_active)
+		sched_arm(JOB_NEXTDAYWEATHER, 5000);
+
+	refresh_pending |= stale;
+	refresh_flush();
+}
+
+/* Called on the minute tick, battery changes and wrist taps */
+static void governor_update() {
+	uint8_t tier = governor_pick_tier();
+
+	if(tier == governor_tier) return;
+	governor_tier = tier;
+
+	// Jobs stay cancelled while disconnected, reconnecting arms them for the new tier
+	if(!bluetooth_connection_service_peek()) return;
+
+	governor_catch_up(governor_sync());
+}
+
+/* Ask only for what is past its refresh interval, the rest waits for its turn */
+static void cache_start_jobs() {
+	governor_tier = governor_pick_tier();
+	governor_catch_up(governor_sync());
+}
+
+// Reconnect sync
+static const uint8_t SYNC_PANEL_TOPICS[NUM_LAYERS] = {
+	[MUSIC_LAYER]		= TOPIC_MUSIC,
+	[LOCATION_LAYER]	= TOPIC_GPS,
+	[FORECAST_LAYER]	= TOPIC_WEATHER,
+	[STOCKS_LAYER]		= NUM_TOPICS,
+	[BITCOIN_LAYER]		= NUM_TOPICS,
+};
+
+/* Weather and calendar are always on screen, then whatever the shown panel needs, then the rest */
+static uint8_t sync_next(uint8_t topics) {
+	const uint8_t fixed = (1 << TOPIC_WEATHER) | (1 << TOPIC_CALENDAR);
+	uint8_t topic, panel_topic = SYNC_PANEL_TOPICS[active_layer];
+
+	for(topic = 0; topic < NUM_TOPICS; topic++)
+		if(topics & fixed & (1 << topic)) return topic;
+	if((panel_topic < NUM_TOPICS) && (topics & (1 << panel_topic))) return panel_topic;
+	for(topic = 0; topic < NUM_TOPICS; topic++)
+		if(topics & (1 << topic)) return topic;
+	return NUM_TOPICS;
+}
+
+/* Version, flags and count, then per topic in sync_next order its RefreshTopics index and
+   the version held as little-endian uint16 */
+static bool sync_write_blob(DictionaryIterator *iter) {
+	uint8_t blob[SYNC_BLOB_SIZE], *p = blob + 3;
+	uint8_t topic, topics = topic_sync.pending;
+
+	blob[0] = SYNC_VERSION;
+	blob[1] = 0;
+	blob[2] = 0;
+	while((topic = sync_next(topics)) != NUM_TOPICS) {
+		topics &= ~(1 << topic);
+		*p++ = topic;
+		link_put16(&p, sync_versions[topic]);
+		blob[2]++;
+	}
+	return dict_write_data(iter, SM_TOPIC_SYNC_KEY, blob, p - blob) == DICT_OK;
+}
+
+static void sync_finish(bool complete) {
+	uint32_t elapsed = get_time_ms() - topic_sync.started;
+	uint8_t stale;
+
+	TRACE(TRACE_LINK, TRACE_SYNC, topic_sync.pending, elapsed);
+	topic_sync.active = false;
+	sched_cancel(JOB_SYNC);
+	if(complete) {
+		topic_sync.completed++;
+		topic_sync.last_ms = elapsed;
+		topic_sync.max_ms = MAX(topic_sync.max_ms, elapsed);
+	}
+
+	// Timers run from the fresh data now, whatever never came goes out in one batch
+	stale = governor_sync();
+	if(stale)
+		governor_catch_up(stale);
+}
+
+/* Called from cache_touch whenever a topic's data comes in */
+static void sync_arrived(uint8_t topic) {
+	if(!topic_sync.active || !(topic_sync.pending & (1 << topic))) return;
+
+	topic_sync.pending &= ~(1 << topic);
+	if(topic_sync.pending == 0)
+		sync_finish(true);
+}
+
+/* Replaces the burst of refreshes on reconnect: one version vector for every topic the tier polls */
+static void sync_start() {
+	uint8_t topic;
+
+	topic_sync.pending = 0;
+	for(topic = 0; topic < NUM_TOPICS; topic++)
+		if(refresh_interval(topic) * GOVERNOR_SCALE[governor_tier][topic] != 0)
+			topic_sync.pending |= (1 << topic);
+	topic_sync.requested = 0;
+	topic_sync.started = get_time_ms();
+	topic_sync.active = (topic_sync.pending != 0);
+	if(!topic_sync.active) return;
+
+	topic_sync.count++;
+	sendRefresh(SM_TOPIC_SYNC_KEY);
+	sched_arm(JOB_SYNC, SYNC_REPLY_TIMEOUT);
+}
+
+/* No answer to the vector, or the announced data is late: ask for one topic at a time, visible first */
+static void timer_cbk_sync() {
+	uint8_t topic;
+
+	TRACE(TRACE_JOBS, TRACE_JOB, JOB_SYNC, 0);
+	if(!topic_sync.active) return;
+
+	topic = sync_next(topic_sync.pending & ~topic_sync.requested);
+	if(topic == NUM_TOPICS) {
+		sync_finish(false);
+		return;
+	}
+	topic_sync.requested |= (1 << topic);
+	governor_catch_up(1 << topic);
+	sched_arm(JOB_SYNC, SYNC_STAGGER);
+}
+
+// Activity estimator
+/* Location refresh follows the new state. Coming back from a long still spell the last
+   fix is likely somewhere else, so that asks right away */
+static void activity_set(uint8_t state) {
+	time_t now = time(NULL);
+	bool long_still;
+
+	if(state == activity.state) return;
+	TRACE(TRACE_JOBS, TRACE_ACTIVITY, state, activity.level);
+
+	long_still = (activity.state == ACTIVITY_STILL) && (now - activity.still_since >= ACTIVITY_LONG_STILL);
+	activity.state = state;
+	if(state == ACTIVITY_STILL) activity.still_since = now;
+
+	// Jobs stay cancelled while disconnected, reconnecting arms GPS for the new state
+	if(!bluetooth_connection_service_peek()) return;
+
+	if(long_still) {
+		governor_arm(TOPIC_GPS, refresh_interval(TOPIC_GPS));
+		refresh_request(TOPIC_GPS);
+	} else
+		governor_catch_up(governor_sync() & (1 << TOPIC_GPS));
+}
+
+/* Mean change between consecutive samples, smoothed over batches. Steps swing hard, a
+   vehicle hums steadily and a wrist at rest barely moves. Still needs a run of quiet batches */
+static void activity_handler(AccelData *data, uint32_t num_samples) {
+	uint32_t i, energy = 0;
+	uint8_t state = activity.state;
+
+	if(num_samples < 2) return;
+	for(i = 0; i < num_samples; i++) {
+		if(data[i].did_vibrate) return;
+	}
+
+	prof_begin(PROF_ACCEL);
+	for(i = 1; i < num_samples; i++)
+		energy += abs(data[i].x - data[i - 1].x) + abs(data[i].y - data[i - 1].y) + abs(data[i].z - data[i - 1].z);
+	activity.level = (activity.level * 3 + (int32_t)(energy / (num_samples - 1))) / 4;
+
+	if(activity.level < ACTIVITY_STILL_LEVEL) {
+		if(activity.still_batches < ACTIVITY_STILL_BATCHES) activity.still_batches++;
+		if(activity.still_batches == ACTIVITY_STILL_BATCHES) state = ACTIVITY_STILL;
+	} else {
+		activity.still_batches = 0;
+		state = (activity.level < ACTIVITY_WALK_LEVEL) ? ACTIVITY_VEHICLE : ACTIVITY_WALKING;
+		governor_last_motion = time(NULL);
+	}
+
+	activity_set(state);
+	prof_end(PROF_ACCEL);
+}
+
+// Calendar queue
+/* Title bytes cut back to a whole UTF-8 character, like text_store */
+static void cal_copy_title(char *dst, const uint8_t *src, uint8_t length) {
+	if(length > CAL_QUEUE_TITLE_LENGTH) {
+		length = CAL_QUEUE_TITLE_LENGTH;
+		while((length > 0) && ((src[length] & 0xC0) == 0x80)) length--;
+	}
+	memcpy(dst, src, length);
+	dst[length] = '\0';
+}
+
+/* Put the head of the queue on screen, its time string only serves the raw date display and the cache */
+static void cal_queue_show() {
+	struct tm *t;
+
+	if(cal_queue_count == 0) {
+		appointment_time[0] = '\0';
+		appointment_at = 0;
+		state_set_string(TEXT_CALENDAR_DATE, "No Upcoming");
+		state_set_string(TEXT_CALENDAR_TEXT, "");
+		appt_update();
+		return;
+	}
+
+	t = localtime(&cal_queue[0].start);
+	strftime(appointment_time, sizeof(appointment_time), "%m/%d %H:%M", t);
+	state_set_string(TEXT_CALENDAR_TEXT, cal_queue[0].title);
+	appt_set_time(cal_queue[0].start);
+}
+
+/* Drop every event that has ended, show the next and top the queue up when it runs low */
+static void cal_queue_advance() {
+	time_t now = time(NULL);
+	uint8_t ended = 0;
+
+	while((ended < cal_queue_count) &&
+		  (now >= cal_queue[ended].start + (time_t)cal_queue[ended].duration * 60)) ended++;
+	if(ended) {
+		cal_queue_count -= ended;
+		memmove(cal_queue, cal_queue + ended, cal_queue_count * sizeof(CalEvent));
+	}
+
+	cache_dirty |= (1 << CACHE_CALENDAR);
+	cal_queue_show();
+
+	if(cal_queue_count < CAL_QUEUE_LOW)
+		refresh_request(TOPIC_CALENDAR);
+}
+
+static void cal_queue_insert(const CalEvent *event) {
+	uint8_t i;
+
+	// Full: only an event earlier than the last one gets in
+	if(cal_queue_count == CAL_QUEUE_SIZE) {
+		if(event->start >= cal_queue[CAL_QUEUE_SIZE - 1].start) return;
+		cal_queue_count--;
+	}
+
+	for(i = cal_queue_count; (i > 0) && (cal_queue[i - 1].start > event->start); i--) {
+		cal_queue[i] = cal_queue[i - 1];
+	}
+	cal_queue[i] = *event;
+	cal_queue_count++;
+}
+
+/* Next events in one byte array: version, count, then per event its start (uint32, same
+   clock as time() on the watch), duration in minutes (uint16), title length and title bytes */
+static void rcv_cal_queue(const Tuple *t) {
+	const uint8_t *p = t->value->data, *end = t->value->data + t->length;
+	CalEvent event;
+	uint8_t count, length;
+	time_t now = time(NULL);
+
+	if(p[0] != CAL_QUEUE_VERSION) return;
+	count = p[1];
+	p += 2;
+
+	cache_touch(CACHE_CALENDAR);
+	cal_queue_active = true;
+	cal_queue_count = 0;
+	for(; count && (p + 7 <= end); count--) {
+		event.start = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		event.duration = p[4] | (p[5] << 8);
+		length = p[6];
+		p += 7;
+		if(p + length > end) break;
+		cal_copy_title(event.title, p, length);
+		p += length;
+
+		if(now < event.start + (time_t)event.duration * 60)
+			cal_queue_insert(&event);
+	}
+
+	cal_queue_show();
+	governor_arm(TOPIC_CALENDAR, refresh_interval(TOPIC_CALENDAR));
+}
+
+/* The phone saw the calendar change, fetch the queue again */
+static void rcv_cal_changed(const Tuple *t) {
+	refresh_request(TOPIC_CALENDAR);
+}
+
+// Inbound message handlers
+static void rcv_phone_battery(const Tuple *t) {
+	cache_touch(CACHE_BATTERY);
+	state_set_int(FIELD_PHONE_BATTERY, &status_state.phone_battery, tuple_int(t));
+	//if(DEBUG)
+		//APP_LOG(APP_LOG_LEVEL_DEBUG, "Battery: %d", (int)status_state.phone_battery);
+	if(battery_low && (status_state.phone_battery > 25)) battery_low = false;
+	if(!battery_low && (status_state.phone_battery < 20)) {
+		battery_low = true;
+		vibes_short_pulse();
+	}
+}
+
+static void rcv_weather_temp(const Tuple *t) {
+	cache_touch(CACHE_WEATHER);
+	state_set_text(TEXT_WEATHER_TEMP, t->value->cstring, tuple_text_length(t));
+}
+
+static void rcv_weather_icon(const Tuple *t) {
+	cache_touch(CACHE_WEATHER);
+	state_set_int(FIELD_WEATHER_ICON, &status_state.weather_icon, tuple_int(t));
+}
+
+static void rcv_weather_icon1(const Tuple *t) {
+	cache_touch(CACHE_WEATHER);
+	state_set_int(FIELD_TOMORROW_ICON, &status_state.tomorrow_icon, tuple_int(t));
+}
+
+static void rcv_weather_day1(const Tuple *t) {
+	cache_touch(CACHE_WEATHER);
+	state_set_text(TEXT_TOMORROW_TEMP, t->value->cstring + 6, tuple_text_length(t) - 6);
+}
+
+/* One line per forecast day for the forecast panel, weekday then high/low */
+static void forecast_update() {
+	char text[TEXT_LINE_LENGTH + 1];
+	time_t day = time(NULL);
+	size_t pos = 0;
+	uint8_t i;
+
+	for(i = 0; i < weather_record.num_days; i++) {
+		day += 24 * 60 * 60;
+		pos += strftime(text + pos, sizeof(text) - pos, "%a", localtime(&day));
+		pos += snprintf(text + pos, sizeof(text) - pos, " %d/%d\n", weather_record.days[i].high, weather_record.days[i].low);
+		if(pos >= sizeof(text)) return;
+	}
+	if(pos > 0)
+		state_set_text(TEXT_FORECAST, text, pos - 1);
+}
+
+/* Clamped to what "%d/%d" fits in a temperature slot */
+static int16_t weather_temp(const uint8_t *p) {
+	int16_t temp = (int16_t)(p[0] | (p[1] << 8));
+
+	return MAX(MIN(temp, WEATHER_TEMP_MAX), WEATHER_TEMP_MIN);
+}
+
+/* Version, temp (int16), flags, icon, humidity %, wind, day count, then per day high and
+   low (int16) and icon, all little-endian. Temperatures show as sent, in whatever unit, so
+   the flags byte is not read. Bad icons keep what is shown, extra days are ignored */
+static void rcv_weather_data(const Tuple *t) {
+	const uint8_t *p = t->value->data;
+	WeatherRecord record;
+	char text[sizeof("-32768/-32768")];
+	uint8_t i;
+
+	if((p[0] != WEATHER_RECORD_VERSION) || (t->length < WEATHER_HEADER_SIZE)) return;
+
+	record.temp = weather_temp(p + 1);
+	record.icon = p[4];
+	record.humidity = p[5];
+	record.wind = p[6];
+	record.num_days = MIN(MIN(p[7], WEATHER_FORECAST_DAYS), (t->length - WEATHER_HEADER_SIZE) / WEATHER_DAY_SIZE);
+	for(i = 0, p += WEATHER_HEADER_SIZE; i < record.num_days; i++, p += WEATHER_DAY_SIZE) {
+		record.days[i].high = weather_temp(p);
+		record.days[i].low = weather_temp(p + 2);
+		record.days[i].icon = p[4];
+	}
+
+	cache_touch(CACHE_WEATHER);
+	weather_record = record;
+	weather_record_active = true;
+
+	snprintf(text, sizeof(text), "%d°", record.temp);
+	state_set_string(TEXT_WEATHER_TEMP, text);
+	if(record.icon < NUM_WEATHER_IMAGES)
+		state_set_int(FIELD_WEATHER_ICON, &status_state.weather_icon, record.icon);
+
+	forecast_update();
 
-	result = 0;
-	offset = strlen(string) - 1;
+	if(record.num_days == 0) return;
+	snprintf(text, sizeof(text), "%d/%d", record.days[0].high, record.days[0].low);
+	state_set_string(TEXT_TOMORROW_TEMP, text);
+	if(record.days[0].icon < NUM_WEATHER_IMAGES)
+		state_set_int(FIELD_TOMORROW_ICON, &status_state.tomorrow_icon, record.days[0].icon);
+}
 
-	for(unit = 1, result = 0; offset >= 0; unit = unit * 10) {
-		letter = string[offset];
-		digit = letter2digit(letter);
-		if(digit == -1) return -1;
-		result = result + (unit * digit);
-		offset--;
+static void rcv_update_interval(const Tuple *t) {
+	cache_touch(CACHE_INTERVALS);
+	if(inGPSUpdate == 1) {
+		updateGPSInterval = tuple_int(t) * 1000;
+		inGPSUpdate = 0;
 	}
-	
-	return result;
 }
 
-/* Convert time string ("HH:MM") to number of minutes */
-static int32_t timestr2minutes(char *timestr) {
-	static char hourStr[] = "00";
-	static char minStr[] = "00";
-	int32_t hour, min;
-	int8_t hDigits;
+static void rcv_gps_1(const Tuple *t) {
+	cache_touch(CACHE_LOCATION);
+	state_set_text(TEXT_LOCATION, t->value->cstring, tuple_text_length(t));
+}
 
-	hour = -1;
-	min = -1;
-	
-	//if(DEBUG)
-		//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "timestr2minutes %s", timestr);
-	if(timestr[1] == ':') hDigits = 1; else hDigits = 2;
-	
-	strncpy(hourStr, timestr, hDigits);
-	hourStr[hDigits] = '\0';
-	strncpy(minStr, timestr + hDigits + 1, 2);
-	
-	hour = string2number(hourStr);
-	if(hour < 0) return -1;
-	
-	min = string2number(minStr);
-	if(min < 0) return -1;
-	
-	//if(DEBUG)
-		//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "timestr2minutes: %d", (int)(min + (hour * 60)));
-	return min + (hour * 60);
+static void rcv_cal_time(const Tuple *t) {
+	size_t length = MIN(tuple_text_length(t), 11);
+
+	cache_touch(CACHE_CALENDAR);
+	// "mm/dd hh:mm", converted once on receipt
+	appt_set(t->value->cstring, length);
 }
 
-static void apptDisplay() {
-	int32_t apptInMinutes, timeInMinutes;
-	static char date_time_for_appt[] = "....................";
-	time_t now;
-	struct tm *t;
-	
-	now = time(NULL);
-	t = localtime(&now);
-	
-	strftime(date_time_for_appt, sizeof(date_time_for_appt), "%m/%d", t);
-	
-	if(strncmp(date_time_for_appt, appointment_time, 5) != 0) {
-		text_layer_set_text(calendar_date_layer, appointment_time);
-		layer_set_hidden(calendar_layer, 0);
-		return;
-	}
+static void rcv_cal_text(const Tuple *t) {
+	cache_touch(CACHE_CALENDAR);
+	state_set_text(TEXT_CALENDAR_TEXT, t->value->cstring, tuple_text_length(t));
+}
 
-	/* Manage appoitment notification */
-	apptInMinutes = timestr2minutes(appointment_time + 6);
-	if(apptInMinutes >= 0) {
-		timeInMinutes = (t->tm_hour * 60) + t->tm_min;
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "apptDisplay: %d, %d", (int)apptInMinutes, (int)timeInMinutes);
-		if(apptInMinutes < timeInMinutes) {
-			if(((timeInMinutes - apptInMinutes) / 60) > 0) {
-				snprintf(date_time_for_appt, 20, "In %dh %dm", 
-						 (int)((timeInMinutes - apptInMinutes) / 60),
-						 (int)((timeInMinutes - apptInMinutes) % 60));
-			} else {
-				snprintf(date_time_for_appt, 20, "%d min in", (int)(timeInMinutes - apptInMinutes));
-			}
-			text_layer_set_text(calendar_date_layer, date_time_for_appt); 	
-			layer_set_hidden(calendar_layer, 0);  	
-		}
-		if(apptInMinutes > timeInMinutes) {
-			if(((apptInMinutes - timeInMinutes) / 60) > 0) {
-				snprintf(date_time_for_appt, 20, "In %dh %dm", 
-						 (int)((apptInMinutes - timeInMinutes) / 60),
-						 (int)((apptInMinutes - timeInMinutes) % 60));
-			} else {
-				snprintf(date_time_for_appt, 20, "In %d min", (int)(apptInMinutes - timeInMinutes));
-			}
-			text_layer_set_text(calendar_date_layer, date_time_for_appt); 	
-			layer_set_hidden(calendar_layer, 0);  	
-		}
-		if(apptInMinutes == timeInMinutes) {
-			text_layer_set_text(calendar_date_layer, "Now!"); 	
-			layer_set_hidden(calendar_layer, 0);  	
-			vibes_double_pulse();
-		}
-		if((apptInMinutes >= timeInMinutes) && ((apptInMinutes - timeInMinutes) == 15)) {
-			vibes_short_pulse();
-		}
-	}
-	
-	layer_set_hidden(calendar_layer, 0);
+static void rcv_music_artist(const Tuple *t) {
+	cache_touch(CACHE_MUSIC);
+	state_set_text(TEXT_MUSIC_ARTIST, t->value->cstring, tuple_text_length(t));
 }
- 
-static AppMessageResult sm_message_out_get(DictionaryIterator **iter_out) {
-    AppMessageResult result = app_message_outbox_begin(iter_out);
-    if(result != APP_MSG_OK) return result;
-    dict_write_int32(*iter_out, SM_SEQUENCE_NUMBER_KEY, ++s_sequence_number);
-    if(s_sequence_number == 0xFFFFFFFF) {
-        s_sequence_number = 1;
-    }
-	//if(DEBUG)
-		//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "About to send to app");
-    return APP_MSG_OK;
+
+static void rcv_music_title(const Tuple *t) {
+	cache_touch(CACHE_MUSIC);
+	state_set_text(TEXT_MUSIC_TITLE, t->value->cstring, tuple_text_length(t));
 }
 
-static void reset_sequence_number() {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Reseting sequence number");
-	if(!bluetooth_connection_service_peek()) return;
-	
-    DictionaryIterator *iter = NULL;
-    app_message_outbox_begin(&iter);
-    if(!iter) return;
-    dict_write_int32(iter, SM_SEQUENCE_NUMBER_KEY, 0xFFFFFFFF);
-    app_message_outbox_send();
+static void rcv_weather_interval(const Tuple *t) {
+	cache_touch(CACHE_INTERVALS);
+	updateWeatherInterval = tuple_int(t) * 1000;
+
+	governor_arm(TOPIC_WEATHER, refresh_interval(TOPIC_WEATHER));
 }
 
+static void rcv_calendar_interval(const Tuple *t) {
+	cache_touch(CACHE_INTERVALS);
+	updateCalandarInterval = tuple_int(t) * 1000;
 
-static void sendCommand(int key) {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Sending to app: %d", key);
-	if(!bluetooth_connection_service_peek()) return;
+	governor_arm(TOPIC_CALENDAR, refresh_interval(TOPIC_CALENDAR));
+}
 
-	if(sending == 1) return;
+static void rcv_song_length(const Tuple *t) {
+	updateMusicInterval = tuple_int(t) * 1000;
 
-	DictionaryIterator* iterout = NULL;
-	sm_message_out_get(&iterout);
-    if(!iterout) return;
-	
-	if(dict_write_int8(iterout, key, -1) != DICT_OK) return;
-	sending = 1;
-	app_message_outbox_send();
+	// A phone that reports progress keeps the job aligned on the track end
+	governor_arm(TOPIC_MUSIC, refresh_interval(TOPIC_MUSIC));
 }
 
+/* State, elapsed and duration in seconds (uint16, little-endian), once per track or state change */
+static void rcv_play_status(const Tuple *t) {
+	const uint8_t *p = t->value->data;
 
-static void sendCommandInt(int key, int param) {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Sending to app: %d, %d", key, param);
-	if(sending == 1) return;
+	cache_touch(CACHE_MUSIC);
+	music_progress_active = true;
+	music_progress.state = (p[0] <= MUSIC_PAUSED) ? p[0] : MUSIC_STOPPED;
+	music_progress.elapsed = p[1] | (p[2] << 8);
+	music_progress.duration = p[3] | (p[4] << 8);
+	music_progress.at = time(NULL);
 
-	DictionaryIterator* iterout = NULL;
-	sm_message_out_get(&iterout);
-    if(!iterout) return;
-	
-	if(dict_write_int8(iterout, key, param) != DICT_OK) return;
-	sending = 1;
-	app_message_outbox_send();
+	music_progress_update();
+	governor_arm(TOPIC_MUSIC, refresh_interval(TOPIC_MUSIC));
 }
 
-// Timer callbacks
-static void timer_cbk_weather() {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Weather update callback");
+/* Quiet hours as (start hour << 8) | end hour, local time */
+static void rcv_quiet_hours(const Tuple *t) {
+	int32_t value = tuple_int(t);
+	uint8_t start = (value >> 8) & 0xFF, end = value & 0xFF;
 
-	if(sending) psleep(1000);
+	if((start >= 24) || (end >= 24)) return;
 
-	if(timerUpdateWeather) {
-		app_timer_cancel(timerUpdateWeather);
-		timerUpdateWeather = NULL;
-	}
-	timerUpdateWeather = app_timer_register(updateWeatherInterval, timer_cbk_weather, NULL);
+	cache_touch(CACHE_QUIET_HOURS);
+	quiet_hours.start = start;
+	quiet_hours.end = end;
+	governor_update();
+}
 
-	if(current_app != WEATHER_APP)
-		sendCommandInt(SM_SCREEN_ENTER_KEY, WEATHER_APP);
-	sendCommand(SM_STATUS_UPD_WEATHER_KEY);	
+/* The phone asks for the link statistics blob */
+static void rcv_link_stats(const Tuple *t) {
+	sendRefresh(SM_LINK_STATS_KEY);
 }
-		
-static void timer_cbk_calandar() {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Calandar update callback");
-	if(sending) psleep(1000);
-	
-	if(timerUpdateCalendar) {
-		app_timer_cancel(timerUpdateCalendar);
-		timerUpdateCalendar = NULL;
-	}
-	timerUpdateCalendar = app_timer_register(updateCalandarInterval, timer_cbk_calandar, NULL);
 
-	if(current_app != STATUS_SCREEN_APP)
-		sendCommandInt(SM_SCREEN_ENTER_KEY, STATUS_SCREEN_APP);
-	sendCommand(SM_STATUS_UPD_CAL_KEY);	
+/* The phone asks for the trace ring, 1 also writes it to the app log. Without a ring there is no answer */
+static void rcv_trace_dump(const Tuple *t) {
+#if TRACE_LEVEL > 0
+	if(tuple_int(t) == 1)
+		trace_dump_log();
+	sendRefresh(SM_TRACE_DUMP_KEY);
+#endif
 }
 
-static void timer_cbk_music() {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Music update callback");
+/* Version, flags and count, then topic and uint16 version entries. Without SYNC_REPLY they stamp
+   the data in the same message. With it they answer the vector: the listed topics changed and
+   their data follows, the others are as we hold them */
+static void rcv_topic_sync(const Tuple *t) {
+	const uint8_t *p = t->value->data, *end = p + t->length;
+	uint8_t topic, count, listed = 0, unchanged;
+
+	if(p[0] != SYNC_VERSION) return;
+	count = p[2];
+	for(p += 3; count && (p + SYNC_ENTRY_SIZE <= end); count--, p += SYNC_ENTRY_SIZE) {
+		if(p[0] >= NUM_TOPICS) continue;
+		listed |= (1 << p[0]);
+		sync_versions[p[0]] = p[1] | (p[2] << 8);
+	}
 
-	if(sending) psleep(1000);
+	if(!(t->value->data[1] & SYNC_REPLY) || !topic_sync.active) return;
 
-	if(timerUpdateMusic) {
-		app_timer_cancel(timerUpdateMusic);
-		timerUpdateMusic = NULL;
-	}
-	timerUpdateCalendar = app_timer_register(updateMusicInterval, timer_cbk_calandar, NULL);
-	
-	if(current_app != STATUS_SCREEN_APP)
-		sendCommandInt(SM_SCREEN_ENTER_KEY, STATUS_SCREEN_APP);
-	sendCommand(SM_SONG_LENGTH_KEY);	
+	// The data on its way needs no asking, the staggered requests wait for it
+	topic_sync.requested |= listed;
+	unchanged = topic_sync.pending & ~listed;
+	for(topic = 0; topic < NUM_TOPICS; topic++)
+		if(unchanged & (1 << topic)) cache_touch(topic);
+	if(topic_sync.active)
+		sched_arm(JOB_SYNC, SYNC_REPLY_TIMEOUT);
 }
 
-static void timer_cbk_layerswap() {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Swap layers callback");
+/* The phone asks for one recorder block, host/README.md has the replay */
+static void rcv_record(const Tuple *t) {
+	int32_t block = tuple_int(t);
 
-	swap_bottom_layer();	
+	if(record_block && (block >= 0) && (block < RECORD_BLOCKS))
+		sendRefreshInt(SM_RECORD_KEY, block);
+}
 
-	if(timerSwapBottomLayer) {
-		app_timer_cancel(timerSwapBottomLayer);
-		timerSwapBottomLayer = NULL;
+/* Flags, sequence number of the first sample, then the samples. The first one into an empty
+   ring is absolute, the rest int8 deltas from the one before or SPARK_ESCAPE and an absolute byte */
+static void rcv_spark(const Tuple *t) {
+	const uint8_t *p = t->value->data, *end = p + t->length;
+	uint8_t feed = (t->key == SM_STOCKS_GRAPH_KEY) ? SPARK_STOCKS : SPARK_BITCOIN;
+	Sparkline *spark = &sparks[feed];
+	int32_t value = 0;
+
+	if(p[0] & SPARK_RESET) {
+		spark_clear(spark);
+		spark->active = true;
+		spark->seq = p[1];
+	} else if(!spark->active || (p[1] != spark->seq)) {
+		// Missed some: deltas are worthless without them, ask for the whole series again
+		spark_clear(spark);
+		state_dirty |= (1 << SPARK_FIELDS[feed]);
+		sendRefreshInt(t->key, 0);
+		return;
 	}
-	//timerSwapBottomLayer = app_timer_register(SWAP_BOTTOM_LAYER_INTERVAL, timer_cbk_layerswap, NULL);
-}
-	
-static void timer_cbk_nextdayweather() {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Next day weather callback");
-	if(sending) psleep(1000);
 
-	if(timerUpdateWeatherForecast) {
-		app_timer_cancel(timerUpdateWeatherForecast);
-		timerUpdateWeatherForecast = NULL;
+	if(spark->count)
+		value = spark_sample(spark, 0);
+	for(p += SPARK_HEADER_SIZE; p < end; p++) {
+		if(spark->count == 0)
+			value = *p;
+		else if((int8_t)*p == SPARK_ESCAPE) {
+			if(++p == end) break;
+			value = *p;
+		} else
+			value = MAX(0, MIN(255, value + (int8_t)*p));
+		spark_append(spark, value);
 	}
-	
-	if(current_app != WEATHER_APP)
-		sendCommandInt(SM_SCREEN_ENTER_KEY, WEATHER_APP);
-	sendCommand(SM_STATUS_UPD_WEATHER_KEY);	
+
+	spark_rescale(spark);
+	state_dirty |= (1 << SPARK_FIELDS[feed]);
 }
-		
-static void timer_cbk_gps() {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "GPS update callback");
 
-	if(sending) psleep(1000);
+/* The phone batches: its answer to the probe, or to a batch, carries this key */
+static void rcv_refresh_batch(const Tuple *t) {
+	refresh_batch_active = true;
+}
 
-	sendCommandInt(SM_SCREEN_ENTER_KEY, GPS_APP);
-		
-	if(timerUpdateGps) {
-		app_timer_cancel(timerUpdateGps);
-		timerUpdateGps = NULL;
+/* Topics the phone will push, it sends their current values along. Polled topics stretch to the keep-alive */
+static void rcv_subscribe(const Tuple *t) {
+	sub_active = tuple_int(t) & ((1 << NUM_TOPICS) - 1);
+	if(bluetooth_connection_service_peek())
+		governor_sync();
+}
+
+/* Stocks and bitcoin panel texts, shown as the phone formats them */
+static void rcv_quote(const Tuple *t) {
+	uint8_t slot;
+
+	switch(t->key) {
+		case SM_STOCKS_TITLE_KEY:	slot = TEXT_STOCKS_TITLE; break;
+		case SM_STOCKS_CURR_KEY:	slot = TEXT_STOCKS_PRICE; break;
+		case SM_STOCKS_LOW_KEY:		slot = TEXT_STOCKS_LOW; break;
+		case SM_STOCKS_HIGH_KEY:	slot = TEXT_STOCKS_HIGH; break;
+		case SM_BITCOIN_TITLE_KEY:	slot = TEXT_BITCOIN_TITLE; break;
+		case SM_BITCOIN_CURR_KEY:	slot = TEXT_BITCOIN_PRICE; break;
+		case SM_BITCOIN_LOW_KEY:	slot = TEXT_BITCOIN_LOW; break;
+		case SM_BITCOIN_HIGH_KEY:	slot = TEXT_BITCOIN_HIGH; break;
+		default: return;
+	}
+	state_set_text(slot, t->value->cstring, tuple_text_length(t));
+}
+
+/* Indexed by key - SM_KEY_BASE, straight from SM_PROTOCOL. Keys without a handler stay zero */
+#define RCV_ENTRY(name, id, types, min, in_max, out_max, batched, handler) \
+	[(id) - SM_KEY_BASE] = {handler, types, min, in_max},
+static const RcvEntry rcv_table[SM_NUM_KEYS] = {SM_PROTOCOL(RCV_ENTRY)};
+
+/* Two rows with the same id make duplicate case labels, so a clash fails the build */
+#define SM_KEY_CASE(name, ...)	case name:
+static bool sm_key_known(uint32_t key) {
+	switch(key) {
+		SM_PROTOCOL(SM_KEY_CASE)
+			return true;
+		default:
+			return false;
 	}
-	timerUpdateGps = app_timer_register(updateGPSInterval, timer_cbk_gps, NULL);
 }
-	
-static void timer_cbk_connectionrecover() {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Recover connection callback");
-	if(sending) psleep(1000);
 
-	reset_sequence_number();
-	sendCommandInt(SM_SCREEN_ENTER_KEY, STATUS_SCREEN_APP);
+/* Ids must fit the one byte offsets link stats keep, and lengths must make sense */
+#define SM_KEY_CHECK(name, id, types, min, in_max, ...) \
+	_Static_assert(((id) > SM_KEY_BASE) && ((id) - SM_KEY_BASE <= 0xFF) && ((min) <= (in_max)), #name " is out of range");
+SM_PROTOCOL(SM_KEY_CHECK)
+
+/* Buffer sizes as dict_calc_buffer_size counts them: a count byte, then 7 header bytes per tuple.
+   The phone may send every inbound key in one message. The watch sends the sequence number
+   plus either the refresh batch or a single key, so the outbox is the larger of the two */
+#define SM_TUPLE_SIZE(length)	(7 + (length))
+#define SM_INBOX_TUPLE(name, id, types, min, in_max, ...)	+ ((in_max) ? SM_TUPLE_SIZE(in_max) : 0)
+#define SM_BATCH_TUPLE(name, id, types, min, in_max, out_max, batched, ...)	+ ((batched) ? SM_TUPLE_SIZE(out_max) : 0)
+#define SM_OUTBOX_TUPLE(name, id, types, min, in_max, out_max, ...)	uint8_t out_##name[SM_TUPLE_SIZE(out_max)];
+typedef union {SM_PROTOCOL(SM_OUTBOX_TUPLE)} SmLargestTuple;
+#define SM_INBOX_SIZE	(1 SM_PROTOCOL(SM_INBOX_TUPLE))
+#define SM_BATCH_SIZE	(0 SM_PROTOCOL(SM_BATCH_TUPLE))
+#define SM_OUTBOX_SIZE	(1 + SM_TUPLE_SIZE(4) + MAX(SM_BATCH_SIZE, sizeof(SmLargestTuple)))
+
+/* Reject a tuple whose type or length doesn't match what its handler reads. A string longer
+   than its slot is let through for text_store to cut */
+static bool rcv_tuple_valid(const RcvEntry *entry, const Tuple *t) {
+	if(!(entry->types & (1 << t->type))) return false;
+	if(t->length < entry->min_length) return false;
+	if((t->type != TUPLE_CSTRING) && (t->length > entry->max_length)) return false;
+	if((t->type == TUPLE_CSTRING) && (t->value->cstring[t->length - 1] != '\0')) return false;
+	return true;
 }
 
 static void rcv(DictionaryIterator *received, void *context) {
 	// Got a message callback
+	const RcvEntry *entry;
 	Tuple *t;
-	int8_t interval;
-
-	//if(DEBUG)
-		//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Recieved data from app");
-	
-	connected = 1;
-
-	t = dict_find(received, SM_COUNT_BATTERY_KEY); 
-	if (t!=NULL) {
-		batteryPercent = t->value->uint8;
-		//if(DEBUG)
-			//APP_LOG(APP_LOG_LEVEL_DEBUG, "Battery: %d", (int)batteryPercent);
-		if(battery_low && (batteryPercent > 25)) battery_low = false;
-		if(!battery_low && (batteryPercent < 20)) {
-			battery_low = true;
-			vibes_short_pulse();
-		}
-		layer_mark_dirty(battery_ind_layer);
-	}
-
-	t=dict_find(received, SM_WEATHER_TEMP_KEY); 
-	if (t!=NULL) {
-		memcpy(weather_temp_str, t->value->cstring, 
-			   MIN(sizeof(weather_temp_str),strlen(t->value->cstring)));
-        weather_temp_str[MIN(sizeof(weather_temp_str),strlen(t->value->cstring))] = '\0';
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Temp: %s", weather_temp_str);
-		text_layer_set_text(text_weather_temp_layer, weather_temp_str); 
-	}
 
-	t=dict_find(received, SM_WEATHER_ICON_KEY); 
-	if (t!=NULL) {
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Weather: %d", t->value->uint8);
-		bitmap_layer_set_bitmap(weather_image, weather_status_small_imgs[t->value->uint8]);	  	
-	}
-
-	t=dict_find(received, SM_WEATHER_ICON1_KEY); 
-	if (t!=NULL) {
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Tomorrow icon: %d", t->value->uint8);
-		bitmap_layer_set_bitmap(weather_tomorrow_image, weather_status_small_imgs[t->value->uint8]);	  	
-	}
-	
-	t=dict_find(received, SM_WEATHER_DAY1_KEY); 
-	if (t!=NULL) {
-		memcpy(weather_tomorrow_temp_str, t->value->cstring + 6,
-			   MIN(sizeof(weather_tomorrow_temp_str), strlen(t->value->cstring) - 6));
-        weather_tomorrow_temp_str[MIN(sizeof(weather_tomorrow_temp_str), strlen(t->value->cstring) - 6)] = '\0';
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Tomorrow: %s", weather_tomorrow_temp_str);
-		text_layer_set_text(text_weather_tomorrow_temp_layer, weather_tomorrow_temp_str); 	
-	}
-
-	t=dict_find(received, SM_UPDATE_INTERVAL_KEY); 
-	if (t!=NULL) {
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "GPS interval: %d", (int)t->value->int32);
-		if(inGPSUpdate == 1) {
-			updateGPSInterval = t->value->int32 * 1000;
-			inGPSUpdate = 0;
-		}
-	}
+	record_dict(RECORD_IN, received, APP_MSG_OK);
 
-	t=dict_find(received, SM_GPS_1_KEY); 
-	if (t!=NULL) {
-		memcpy(location_street_str, t->value->cstring,
-			   MIN(sizeof(location_street_str), strlen(t->value->cstring)));
-        location_street_str[MIN(sizeof(location_street_str), strlen(t->value->cstring))] = '\0';
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Location: %s", location_street_str);
-		text_layer_set_text(location_street_layer, location_street_str);
-	}
-
-	t=dict_find(received, SM_STATUS_CAL_TIME_KEY); 
-	if (t!=NULL) {
-		memcpy(calendar_date_str, t->value->cstring,
-			   MIN(sizeof(calendar_date_str), strlen(t->value->cstring)));
-        calendar_date_str[MIN(sizeof(calendar_date_str), strlen(t->value->cstring))] = '\0';
-		//text_layer_set_text(text_status_layer, calendar_date_str); 	
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Calendar date: %s", calendar_date_str);
-		strncpy(appointment_time, calendar_date_str, 11);
-		apptDisplay();
-	}
-
-	t=dict_find(received, SM_STATUS_CAL_TEXT_KEY); 
-	if (t!=NULL) {
-		memcpy(calendar_text_str, t->value->cstring,
-			   MIN(sizeof(calendar_text_str), strlen(t->value->cstring)));
-        calendar_text_str[MIN(sizeof(calendar_text_str), strlen(t->value->cstring))] = '\0';
-		text_layer_set_text(calendar_text_layer, calendar_text_str); 	
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Calendar: %s", calendar_text_str);
-		
-		if(strlen(calendar_text_str) <= 15)
-			text_layer_set_font(calendar_text_layer, fonts_get_system_font(FONT_KEY_GOTHIC_24_BOLD));
-		else
-			if(strlen(calendar_text_str) <= 18)
-				text_layer_set_font(calendar_text_layer, fonts_get_system_font(FONT_KEY_GOTHIC_18_BOLD));
-			else 
-				text_layer_set_font(calendar_text_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14_BOLD));
-	}
-
-	t=dict_find(received, SM_STATUS_MUS_ARTIST_KEY); 
-	if (t!=NULL) {
-		memcpy(music_artist_str, t->value->cstring,
-			   MIN(sizeof(music_artist_str), strlen(t->value->cstring)));
-        music_artist_str[MIN(sizeof(music_artist_str), strlen(t->value->cstring))] = '\0';
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Artist: %s", music_artist_str);
-		text_layer_set_text(music_artist_layer, music_artist_str); 	
-	}
-
-	t=dict_find(received, SM_STATUS_MUS_TITLE_KEY); 
-	if (t!=NULL) {
-		memcpy(music_title_str, t->value->cstring,
-			   MIN(sizeof(music_title_str), strlen(t->value->cstring)));
-        music_title_str[MIN(sizeof(music_title_str), strlen(t->value->cstring))] = '\0';
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Song: %s", music_title_str);
-		text_layer_set_text(music_song_layer, music_title_str); 	
-	}
-
-	t=dict_find(received, SM_STATUS_UPD_WEATHER_KEY); 
-	if (t!=NULL) {
-			updateWeatherInterval = t->value->int32 * 1000;
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Weather interval: %d", (int)t->value->int32);
-
-		if(timerUpdateWeather) {
-			app_timer_cancel(timerUpdateWeather);
-			timerUpdateWeather = NULL;
-		}
-		timerUpdateWeather = app_timer_register(updateWeatherInterval, timer_cbk_weather, NULL);
-	}
+	prof_begin(PROF_RCV);
+	connected = 1;
+	link_ok();
 
-	t=dict_find(received, SM_STATUS_UPD_CAL_KEY); 
-	if (t!=NULL) {
-		updateCalandarInterval = t->value->int32 * 1000;
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Calandar interval: %d", (int)t->value->int32);
+	// Single pass over the dictionary, whatever the number of keys we know
+	for(t = dict_read_first(received); t != NULL; t = dict_read_next(received)) {
+		if(!sm_key_known(t->key)) continue;
 
-		if(timerUpdateCalendar) {
-			app_timer_cancel(timerUpdateCalendar);
-			timerUpdateCalendar = NULL;
-		}
-		timerUpdateCalendar = app_timer_register(updateCalandarInterval, timer_cbk_calandar, NULL);
-	}
+		TRACE(TRACE_VERBOSE, TRACE_RECEIVED, t->key, t->length);
+		link_count_received(t);
+		if((t->key == SM_SEQUENCE_NUMBER_KEY) && (t->type != TUPLE_CSTRING))
+			link_match_reply(tuple_int(t));
 
-	t=dict_find(received, SM_SONG_LENGTH_KEY); 
-	if (t!=NULL) {
-		updateMusicInterval = t->value->int32 * 1000;
-		//if(DEBUG)
-			//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Music interval: %d", (int)t->value->int32);
+		entry = &rcv_table[t->key - SM_KEY_BASE];
+		if(!entry->handler) continue;
 
-		if(timerUpdateMusic) {
-			app_timer_cancel(timerUpdateMusic);
-			timerUpdateMusic = NULL;
+		if(!rcv_tuple_valid(entry, t)) {
+			if(DEBUG)
+				APP_LOG(APP_LOG_LEVEL_DEBUG, "Bad tuple: %d, type %d, length %d", (int)t->key, t->type, t->length);
+			continue;
 		}
-		timerUpdateMusic = app_timer_register(updateMusicInterval, timer_cbk_music, NULL);
+		entry->handler(t);
 	}
 	
-	if(!DEBUG)
-		text_layer_set_text(text_status_layer, "");
+	state_set_status("");
 
+	state_flush();
+	prof_end(PROF_RCV);
 }
 
 static void dropped(AppMessageResult reason, void *context){
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Message dropper: %d", reason);
+	TRACE(TRACE_LINK, TRACE_DROPPED, 0, reason);
+	record_dict(RECORD_DROPPED, NULL, reason);
+
+	prof_begin(PROF_DROPPED);
+	link_count_dropped(reason);
 
 	// DO SOMETHING WITH THE DROPPED REASON / DISPLAY AN ERROR / RESEND 
-	text_layer_set_text(text_status_layer, "Drop.");
+	state_set_status("Drop.");
 	
 	if(reason == APP_MSG_BUSY) {
-		text_layer_set_text(text_status_layer, ">Busy");
+		state_set_status(">Busy");
 	}
 	
 	if(reason == APP_MSG_BUFFER_OVERFLOW) {
-		text_layer_set_text(text_status_layer, "Over.");
+		state_set_status("Over.");
 	}
 	
-	connected = 0;
+	// The phone resends what we dropped, only a run of drops is worth recovering from
+	link_transient(reason);
 
-	if(timerRecoveryAttempt) {
-		app_timer_cancel(timerRecoveryAttempt);
-		timerRecoveryAttempt = NULL;
-	}
-	timerRecoveryAttempt = app_timer_register(RECOVERY_ATTEMPT_INTERVAL, timer_cbk_connectionrecover, NULL);
+	state_flush();
+	prof_end(PROF_DROPPED);
 }
 
 static void sent_ok(DictionaryIterator *sent, void *context) {
-	//if(DEBUG)
-		//LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Message sent to app");
-
 	Tuple *t;
 	
-	if(timerRecoveryAttempt) {
-		app_timer_cancel(timerRecoveryAttempt);
-		timerRecoveryAttempt = NULL;
-	}
+	TRACE(TRACE_VERBOSE, TRACE_SENT, outbox_in_flight.key, 0);
+	record_dict(RECORD_SENT, sent, APP_MSG_OK);
+
+	prof_begin(PROF_SENT);
+	link_count_outcome(outbox_in_flight.key, sent, APP_MSG_OK);
+	link_ok();
 
 	t = dict_find(sent, SM_SCREEN_ENTER_KEY);
 	if(t) current_app = t->value->int8;
 
 	sending = 0;
-	if(!DEBUG)
-		text_layer_set_text(text_status_layer, "Ok");
+	state_set_status("Ok");
 	
 	connected = 1;
 	inTimeOut = 0;
+
+	state_flush();
+	outbox_drain();
+	prof_end(PROF_SENT);
 }
 
 static void send_failed(DictionaryIterator *failed, AppMessageResult reason, void *context) {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Message failed to send: %d", reason);
+	TRACE(TRACE_LINK, TRACE_SEND_FAILED, outbox_in_flight.key, reason);
+	record_dict(RECORD_FAILED, failed, reason);
 
+	prof_begin(PROF_FAILED);
+	link_count_outcome(outbox_in_flight.key, failed, reason);
 	sending = 0;
-	text_layer_set_text(text_status_layer, "Err.");
+	state_set_status("Err.");
+
+	// Give a button press another chance, refreshes come around again anyway
+	if((outbox_in_flight.prio == OUTBOX_PRIO_USER) && (outbox_in_flight.retries < OUTBOX_MAX_RETRIES)) {
+		outbox_in_flight.retries++;
+		if(outbox_make_room(OUTBOX_PRIO_USER))
+			outbox_insert(0, &outbox_in_flight);
+	}
 	
 	if(reason == APP_MSG_NOT_CONNECTED) {
-		text_layer_set_text(text_status_layer, "Disc.");
+		state_set_status("Disc.");
 		if(connected == 1) {
 			vibes_double_pulse();
 		}
 	}
 	
 	if(reason == APP_MSG_SEND_TIMEOUT) {
-		text_layer_set_text(text_status_layer, "T.Out");
+		state_set_status("T.Out");
  		if(inTimeOut == 0) {
 			inTimeOut = 1;
 		} else if(inTimeOut == 1) {
@@ -633,20 +3145,23 @@ static void send_failed(DictionaryIterator *failed, AppMessageResult reason, voi
 	}
 	
 	if(reason == APP_MSG_BUSY) {
-		text_layer_set_text(text_status_layer, "<Busy");
+		state_set_status("<Busy");
 	}
 	
 	if(reason == APP_MSG_SEND_REJECTED) {
-		text_layer_set_text(text_status_layer, "Nack");
+		state_set_status("Nack");
 	}
 	
 	connected = 0;
 
-	if(timerRecoveryAttempt) {
-		app_timer_cancel(timerRecoveryAttempt);
-		timerRecoveryAttempt = NULL;
-	}
-	timerRecoveryAttempt = app_timer_register(RECOVERY_ATTEMPT_INTERVAL, timer_cbk_connectionrecover, NULL);
+	if((reason == APP_MSG_BUSY) || (reason == APP_MSG_SEND_TIMEOUT))
+		link_transient(reason);
+	else
+		link_hard(reason);
+
+	state_flush();
+	outbox_drain();
+	prof_end(PROF_FAILED);
 }
 
 
@@ -674,293 +3189,405 @@ void down_single_click_handler(ClickRecognizerRef recognizer, void *context) {
 	sendCommand(SM_VOLUME_DOWN_KEY);
 }
 
-static void swap_bottom_layer() {
-	ani_out = property_animation_create_layer_frame(animated_layer[active_layer], &GRect(30, 72, 75, 50), &GRect(-75, 72, 75, 50));
-	animation_schedule(&(ani_out->animation));
+// Diagnostics page
+/* Totals, latency buckets and the busiest keys, redrawn each time the page opens */
+static void diag_update_link() {
+	uint8_t i, j, shown, best;
+	uint32_t sent = 0, acked = 0, failed = 0, received = 0, bytes_out = 0, bytes_in = 0, dropped = 0;
+	uint8_t order[LINK_KEY_SLOTS];
+	int pos;
+
+	for(i = 0; i < link_stats.keys_used; i++) {
+		sent += link_keys[i].sent;
+		acked += link_keys[i].acked;
+		failed += link_keys[i].failed;
+		received += link_keys[i].received;
+		bytes_out += link_keys[i].bytes_out;
+		bytes_in += link_keys[i].bytes_in;
+		order[i] = i;
+	}
+	for(i = 0; i < LINK_NUM_RESULTS; i++) dropped += link_stats.dropped[i];
+
+	pos = snprintf(diag_text, LINK_DIAG_TEXT_LENGTH,
+			"Out %d/%d ok, %d fail\nIn %d, %d dropped\nBytes %d out, %d in\nRTT",
+			(int)acked, (int)sent, (int)failed, (int)received, (int)dropped, (int)bytes_out, (int)bytes_in);
+	for(i = 0; (i < LINK_LATENCY_BUCKETS) && (pos < LINK_DIAG_TEXT_LENGTH); i++)
+		pos += snprintf(diag_text + pos, LINK_DIAG_TEXT_LENGTH - pos, " %d", link_stats.latency[i]);
+	if(pos < LINK_DIAG_TEXT_LENGTH)
+		pos += snprintf(diag_text + pos, LINK_DIAG_TEXT_LENGTH - pos, "\nmax %d ms, %d unmatched",
+				(int)link_stats.latency_max, link_stats.unmatched);
+	if(pos < LINK_DIAG_TEXT_LENGTH)
+		pos += snprintf(diag_text + pos, LINK_DIAG_TEXT_LENGTH - pos, "\n%s, %d tries, %d resyncs\n%d/%d/%d/%d s",
+				LINK_STATE_NAMES[link_recovery.state], link_recovery.attempts, link_recovery.resyncs,
+				(int)link_time_in(LINK_CONNECTED), (int)link_time_in(LINK_DEGRADED),
+				(int)link_time_in(LINK_RECOVERING), (int)link_time_in(LINK_DOWN));
+	if(pos < LINK_DIAG_TEXT_LENGTH)
+		pos += snprintf(diag_text + pos, LINK_DIAG_TEXT_LENGTH - pos, "\nSync %d/%d, %d ms, max %d",
+				topic_sync.completed, topic_sync.count, (int)topic_sync.last_ms, (int)topic_sync.max_ms);
+
+	// Busiest keys by bytes either way, a partial selection sort is plenty for a handful of lines
+	for(shown = 0; (shown < 3) && (shown < link_stats.keys_used) && (pos < LINK_DIAG_TEXT_LENGTH); shown++) {
+		best = shown;
+		for(j = shown + 1; j < link_stats.keys_used; j++) {
+			if(link_keys[order[j]].bytes_out + link_keys[order[j]].bytes_in >
+			   link_keys[order[best]].bytes_out + link_keys[order[best]].bytes_in) best = j;
+		}
+		i = order[best];
+		order[best] = order[shown];
+		order[shown] = i;
+		pos += snprintf(diag_text + pos, LINK_DIAG_TEXT_LENGTH - pos, "\n%02X: %d/%d %dB",
+				link_keys[i].key, link_keys[i].sent + link_keys[i].received, link_keys[i].failed,
+				(int)(link_keys[i].bytes_out + link_keys[i].bytes_in));
+	}
+}
 
-	active_layer = (active_layer + 1) % (NUM_LAYERS);
+/* What the outbox queue, refresh batching and dirty tracking have done since launch */
+static void diag_update_app() {
+	uint32_t redraws = 0, skipped = 0;
+	uint8_t field;
 
-	ani_in = property_animation_create_layer_frame(animated_layer[active_layer], &GRect(144, 72, 75, 50), &GRect(30, 72, 75, 50));
-	animation_schedule(&(ani_in->animation));
+	for(field = 0; field < NUM_FIELDS; field++) {
+		redraws += state_stats.redraws[field];
+		skipped += state_stats.skipped[field];
+	}
+
+	snprintf(diag_text, LINK_DIAG_TEXT_LENGTH,
+			"Queue %d, max %d\n%d merged, %d evicted\nUser %d sent, %d lost\n%d ms, avg %d, max %d\n"
+			"Refresh %d msgs\nfor %d topics, %d saved\nRedraw %d, %d avoided",
+			outbox_stats.depth, outbox_stats.max_depth, outbox_stats.coalesced, outbox_stats.evicted,
+			outbox_stats.user_sent, outbox_stats.user_lost, (int)outbox_stats.user_latency_last,
+			outbox_stats.user_sent ? (int)(outbox_stats.user_latency_total / outbox_stats.user_sent) : 0,
+			(int)outbox_stats.user_latency_max, refresh_stats.batches, refresh_stats.topics,
+			refresh_stats.legacy_messages - refresh_stats.batches, (int)redraws, (int)skipped);
 }
 
+static void diag_update() {
+	if(diag_app_page)
+		diag_update_app();
+	else
+		diag_update_link();
+	text_layer_set_text(diag_text_layer, diag_text);
+}
 
-static void config_provider() {
-  window_single_click_subscribe(BUTTON_ID_SELECT, select_single_click_handler);
-  window_long_click_subscribe(BUTTON_ID_SELECT, 0, select_long_click_handler, NULL);
-  window_single_click_subscribe(BUTTON_ID_UP, up_single_click_handler);
-  window_single_click_subscribe(BUTTON_ID_DOWN, down_single_click_handler);
+static void diag_select_click_handler(ClickRecognizerRef recognizer, void *context) {
+	sendCommand(SM_LINK_STATS_KEY);
+	diag_update();
 }
 
+#if TRACE_LEVEL > 0
+static void diag_select_long_click_handler(ClickRecognizerRef recognizer, void *context) {
+	trace_dump_log();
+	sendCommand(SM_TRACE_DUMP_KEY);
+}
+#endif
 
-static void battery_layer_update_callback(Layer *me, GContext* ctx) {
-	//draw the remaining battery percentage
-	graphics_context_set_stroke_color(ctx, GColorBlack);
-	graphics_context_set_fill_color(ctx, GColorWhite);
+/* Flips between the link page and the app's own counters */
+static void diag_down_click_handler(ClickRecognizerRef recognizer, void *context) {
+	diag_app_page = !diag_app_page;
+	diag_update();
+}
 
-	graphics_fill_rect(ctx, GRect(2+16-(int)((batteryPercent/100.0)*16.0), 2, (int)((batteryPercent/100.0)*16.0), 8), 0, GCornerNone);
+static void diag_config_provider() {
+	window_single_click_subscribe(BUTTON_ID_SELECT, diag_select_click_handler);
+	window_single_click_subscribe(BUTTON_ID_DOWN, diag_down_click_handler);
+#if TRACE_LEVEL > 0
+	window_long_click_subscribe(BUTTON_ID_SELECT, 0, diag_select_long_click_handler, NULL);
+#endif
 }
 
-static void pebble_battery_layer_update_callback(Layer *me, GContext* ctx) {
-	//draw the remaining battery percentage
-	graphics_context_set_stroke_color(ctx, GColorBlack);
-	graphics_context_set_fill_color(ctx, GColorWhite);
+static void diag_window_load(Window *this) {
+	Layer *window_layer = window_get_root_layer(this);
+
+	diag_text = malloc(LINK_DIAG_TEXT_LENGTH);
+	diag_text_layer = text_layer_create(layer_get_bounds(window_layer));
+	text_layer_set_text_color(diag_text_layer, GColorWhite);
+	text_layer_set_background_color(diag_text_layer, GColorBlack);
+	text_layer_set_font(diag_text_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
+	layer_add_child(window_layer, text_layer_get_layer(diag_text_layer));
 
-	graphics_fill_rect(ctx, GRect(2+16-(int)((pebble_batteryPercent/100.0)*16.0), 2, (int)((pebble_batteryPercent/100.0)*16.0), 8), 0, GCornerNone);
+	if(diag_text)
+		diag_update();
 }
 
-static void window_load(Window *this) {
-	Layer *window_layer = window_get_root_layer(this);
-	GRect bounds = layer_get_bounds(window_layer);
+static void diag_window_unload(Window *this) {
+	text_layer_destroy(diag_text_layer);
+	free(diag_text);
+	diag_text = NULL;
+	window_destroy(diag_window);
+	diag_window = NULL;
+}
 
-	//init weather images
-	for (int8_t i=0; i<NUM_WEATHER_IMAGES; i++) {
-		weather_status_small_imgs[i] = gbitmap_create_with_resource(WEATHER_SMALL_IMG_IDS[i]);
-	}
-	
-	// init battery layer
-	battery_layer = layer_create(GRect(95, 45, 49, 45));
-	layer_add_child(window_layer, battery_layer);
+static void up_long_click_handler(ClickRecognizerRef recognizer, void *context) {
+	if(diag_window) return;
 
-	battery_image = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_BATTERY);
-	phone_icon = gbitmap_create_with_resource(RESOURCE_ID_PHONE_ICON);
-	pebble_icon = gbitmap_create_with_resource(RESOURCE_ID_PEBBLE_ICON);
+	diag_window = window_create();
+	window_set_window_handlers(diag_window, (WindowHandlers) {
+		.load = diag_window_load,
+		.unload = diag_window_unload,
+	});
+	window_set_click_config_provider(diag_window, (ClickConfigProvider) diag_config_provider);
+	window_set_fullscreen(diag_window, true);
+	window_stack_push(diag_window, true);
+}
 
-	battery_image_layer = bitmap_layer_create(GRect(12, 8, 23, 14));
-	layer_add_child(battery_layer, bitmap_layer_get_layer(battery_image_layer));
-	bitmap_layer_set_bitmap(battery_image_layer, battery_image);
-	
-	phone_icon_layer = bitmap_layer_create(GRect(-5, 5, 20, 20));
-	layer_add_child(battery_layer, bitmap_layer_get_layer(phone_icon_layer));
-	bitmap_layer_set_bitmap(phone_icon_layer, phone_icon);
+// Bottom panels
+/* The active panel and, while sliding, the one it replaces */
+static bool panel_shown(int32_t panel) {
+	return (panel == active_layer) || (panel == panel_leaving);
+}
 
-	battery_ind_layer = layer_create(GRect(14, 9, 19, 11));
-	layer_set_update_proc(battery_ind_layer, battery_layer_update_callback);
-	layer_add_child(battery_layer, battery_ind_layer);
+/* The active panel comes in from the right edge as the last one leaves to the left */
+static int16_t panel_x(int32_t panel) {
+	int32_t progress = panel_progress;
 
-	batteryPercent = 100;
-	layer_mark_dirty(battery_ind_layer);
+	if(panel == active_layer)
+		return PANEL_X + (SCREEN_WIDTH - PANEL_X) * (ANIMATION_NORMALIZED_MAX - progress) / ANIMATION_NORMALIZED_MAX;
+	return PANEL_X - (PANEL_X + PANEL_WIDTH) * progress / ANIMATION_NORMALIZED_MAX;
+}
 
-	// init Pebble battery layer
-	pebble_battery_layer = layer_create(GRect(-5, 45, 49, 45));
-	layer_add_child(window_layer, pebble_battery_layer);
+static void panel_animation_update(Animation *animation, const uint32_t time_normalized) {
+	panel_progress = time_normalized;
+	layer_mark_dirty(canvas_layer);
+}
 
-	pebble_battery_image = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_BATTERY);
+static void panel_animation_stopped(Animation *animation, bool finished, void *context) {
+	panel_leaving = NUM_LAYERS;
+	panel_progress = ANIMATION_NORMALIZED_MAX;
+	layer_mark_dirty(canvas_layer);
 
-	pebble_battery_image_layer = bitmap_layer_create(GRect(12, 8, 23, 14));
-	layer_add_child(pebble_battery_layer, bitmap_layer_get_layer(pebble_battery_image_layer));
-	bitmap_layer_set_bitmap(pebble_battery_image_layer, pebble_battery_image);
-	
-	pebble_icon_layer = bitmap_layer_create(GRect(31, 5, 20, 20));
-	layer_add_child(pebble_battery_layer, bitmap_layer_get_layer(pebble_icon_layer));
-	bitmap_layer_set_bitmap(pebble_icon_layer, pebble_icon);
+	// Nothing left to keep the bar moving for
+	if(!panel_shown(MUSIC_LAYER)) sched_cancel(JOB_MUSICBAR);
+}
 
-	pebble_battery_ind_layer = layer_create(GRect(14, 9, 19, 11));
-	layer_set_update_proc(pebble_battery_ind_layer, pebble_battery_layer_update_callback);
-	layer_add_child(pebble_battery_layer, pebble_battery_ind_layer);
-	
-	BatteryChargeState pb_bat = battery_state_service_peek();
-	pebble_batteryPercent = pb_bat.charge_percent;
-	layer_mark_dirty(pebble_battery_layer);
+static const AnimationImplementation PANEL_ANIMATION = {
+	.update = panel_animation_update
+};
+
+/* The one panel animation is reused for every swap. A flick mid-slide only moves the
+   incoming panel on, so rapid flicks end in one slide to where they add up to */
+static void swap_bottom_layer() {
+	if(animation_is_scheduled(panel_animation)) {
+		active_layer = (active_layer + 1) % (NUM_LAYERS);
+		if(active_layer == panel_leaving)
+			active_layer = (active_layer + 1) % (NUM_LAYERS);
+		layer_mark_dirty(canvas_layer);
+	} else {
+		panel_leaving = active_layer;
+		active_layer = (active_layer + 1) % (NUM_LAYERS);
+		panel_progress = 0;
+		animation_schedule(panel_animation);
+	}
+	prof_mark(GRect(0, PANEL_Y, SCREEN_WIDTH, PANEL_HEIGHT));
 
-	//init weather layer and add weather image, weather condition, temperature
-	weather_layer = layer_create(GRect(0, 70, 144, 45));
-	layer_add_child(window_layer, weather_layer);
+	if(music_progress_active && (active_layer == MUSIC_LAYER)) {
+		music_progress_update();
+		state_flush();
+	}
+}
 
 
-	weather_img = 0;
+static void config_provider() {
+  window_single_click_subscribe(BUTTON_ID_SELECT, select_single_click_handler);
+  window_long_click_subscribe(BUTTON_ID_SELECT, 0, select_long_click_handler, NULL);
+  window_single_click_subscribe(BUTTON_ID_UP, up_single_click_handler);
+  window_long_click_subscribe(BUTTON_ID_UP, 0, up_long_click_handler, NULL);
+  window_single_click_subscribe(BUTTON_ID_DOWN, down_single_click_handler);
+}
 
-	weather_image = bitmap_layer_create(GRect(5, 4, 20, 20)); // GRect(52, 2, 40, 40)
-	layer_add_child(weather_layer, bitmap_layer_get_layer(weather_image));
-	bitmap_layer_set_bitmap(weather_image, weather_status_small_imgs[0]);
 
-	weather_tomorrow_img = 0;
+static void canvas_update_callback(Layer *me, GContext* ctx) {
+	const CanvasText *text;
+	const Sparkline *spark;
+	const char *string;
+	GRect frame;
+	uint8_t i, j, panel;
+	int32_t width;
 
-	weather_tomorrow_image = bitmap_layer_create(GRect(112, 4, 20, 20)); // GRect(52, 2, 40, 40)
-	layer_add_child(weather_layer, bitmap_layer_get_layer(weather_tomorrow_image));
-	bitmap_layer_set_bitmap(weather_tomorrow_image, weather_status_small_imgs[0]);
+	graphics_context_set_stroke_color(ctx, GColorWhite);
+	graphics_context_set_fill_color(ctx, GColorWhite);
+	graphics_context_set_text_color(ctx, GColorWhite);
+
+	// Battery gauges, the fill grows from the right of the outline
+	for(i = 0; i < NUM_GAUGES; i++) {
+		graphics_draw_bitmap_in_rect(ctx, battery_image, CANVAS_GAUGES[i].outline);
+		graphics_draw_bitmap_in_rect(ctx, gauge_icons[i], CANVAS_GAUGES[i].icon);
+		frame = CANVAS_REGIONS[CANVAS_GAUGES[i].field].frame;
+		width = *CANVAS_GAUGES[i].percent * GAUGE_FILL_WIDTH / 100;
+		graphics_fill_rect(ctx, GRect(frame.origin.x + 2 + GAUGE_FILL_WIDTH - width, frame.origin.y + 2, width, 8),
+				0, GCornerNone);
+		prof_draw(3);
+	}
 
-	text_weather_tomorrow_temp_layer = text_layer_create(GRect(105, 23, 31, 20)); // GRect(5, 2, 47, 40)
-	text_layer_set_text_alignment(text_weather_tomorrow_temp_layer, GTextAlignmentCenter);
-	text_layer_set_text_color(text_weather_tomorrow_temp_layer, GColorWhite);
-	text_layer_set_background_color(text_weather_tomorrow_temp_layer, GColorClear);
-	text_layer_set_font(text_weather_tomorrow_temp_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
-	layer_add_child(weather_layer, text_layer_get_layer(text_weather_tomorrow_temp_layer));
-	text_layer_set_text(text_weather_tomorrow_temp_layer, "../.."); 	
-	
-	text_weather_temp_layer = text_layer_create(GRect(5, 23, 25, 20)); // GRect(98, 4, 47, 40)
-	text_layer_set_text_alignment(text_weather_temp_layer, GTextAlignmentCenter);
-	text_layer_set_text_color(text_weather_temp_layer, GColorWhite);
-	text_layer_set_background_color(text_weather_temp_layer, GColorClear);
-	text_layer_set_font(text_weather_temp_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14_BOLD));
-	layer_add_child(weather_layer, text_layer_get_layer(text_weather_temp_layer));
-	text_layer_set_text(text_weather_temp_layer, "-°"); 	
-	
-	//init layers for time and date and status
-	text_date_layer = text_layer_create(bounds);
-	text_layer_set_text_alignment(text_date_layer, GTextAlignmentLeft);
-	text_layer_set_text_color(text_date_layer, GColorWhite);
-	text_layer_set_background_color(text_date_layer, GColorClear);
-	layer_set_frame(text_layer_get_layer(text_date_layer), GRect(47, 48, 50, 30));
-	//text_layer_set_font(text_date_layer, fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_ROBOTO_CONDENSED_21)));
-	text_layer_set_font(text_date_layer, fonts_get_system_font(FONT_KEY_GOTHIC_18));
-	layer_add_child(window_layer, text_layer_get_layer(text_date_layer));
-
-
-	text_time_layer = text_layer_create(bounds);
-	text_layer_set_text_alignment(text_time_layer, GTextAlignmentCenter);
-	text_layer_set_text_color(text_time_layer, GColorWhite);
-	text_layer_set_background_color(text_time_layer, GColorClear);
-	layer_set_frame(text_layer_get_layer(text_time_layer), GRect(0, -5, 144, 50));
-	text_layer_set_font(text_time_layer, fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_ROBOTO_BOLD_SUBSET_49)));
-	layer_add_child(window_layer, text_layer_get_layer(text_time_layer));
-
-	text_status_layer = text_layer_create(GRect(6, 110, 138, 20));
-	text_layer_set_text_alignment(text_status_layer, GTextAlignmentLeft);
-	text_layer_set_text_color(text_status_layer, GColorWhite);
-	text_layer_set_background_color(text_status_layer, GColorClear);
-	text_layer_set_font(text_status_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
-	layer_add_child(window_layer, text_layer_get_layer(text_status_layer));
-	text_layer_set_text(text_status_layer, "Init.");
-
-
-	//init calendar layer
-	calendar_layer = layer_create(GRect(0, 124, 144, 45));
-	layer_add_child(window_layer, calendar_layer);
-	
-	calendar_date_layer = text_layer_create(GRect(6, 0, 132, 21));
-	text_layer_set_text_alignment(calendar_date_layer, GTextAlignmentLeft);
-	text_layer_set_text_color(calendar_date_layer, GColorWhite);
-	text_layer_set_background_color(calendar_date_layer, GColorClear);
-	text_layer_set_font(calendar_date_layer, fonts_get_system_font(FONT_KEY_GOTHIC_18));
-	layer_add_child(calendar_layer, text_layer_get_layer(calendar_date_layer));
-	text_layer_set_text(calendar_date_layer, "No Upcoming"); 	
-
-
-	calendar_text_layer = text_layer_create(GRect(6, 15, 132, 29));
-	text_layer_set_text_alignment(calendar_text_layer, GTextAlignmentLeft);
-	text_layer_set_text_color(calendar_text_layer, GColorWhite);
-	text_layer_set_background_color(calendar_text_layer, GColorClear);
-	text_layer_set_font(calendar_text_layer, fonts_get_system_font(FONT_KEY_GOTHIC_24_BOLD));
-	layer_add_child(calendar_layer, text_layer_get_layer(calendar_text_layer));
-	text_layer_set_text(calendar_text_layer, "");
-	
-	
-	
-	//init music layer
-	animated_layer[MUSIC_LAYER] = layer_create(GRect(144, 72, 75, 50));
-	layer_add_child(window_layer, animated_layer[MUSIC_LAYER]);
-	
-	music_artist_layer = text_layer_create(GRect(0, 0, 75, 24));
-	text_layer_set_text_alignment(music_artist_layer, GTextAlignmentCenter);
-	text_layer_set_text_color(music_artist_layer, GColorWhite);
-	text_layer_set_background_color(music_artist_layer, GColorClear);
-	text_layer_set_font(music_artist_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
-	layer_add_child(animated_layer[MUSIC_LAYER], text_layer_get_layer(music_artist_layer));
-	text_layer_set_text(music_artist_layer, "No Artist"); 	
-
-
-	music_song_layer = text_layer_create(GRect(0, 25, 75, 25));
-	text_layer_set_text_alignment(music_song_layer, GTextAlignmentCenter);
-	text_layer_set_text_color(music_song_layer, GColorWhite);
-	text_layer_set_background_color(music_song_layer, GColorClear);
-	text_layer_set_font(music_song_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14_BOLD));
-	layer_add_child(animated_layer[MUSIC_LAYER], text_layer_get_layer(music_song_layer));
-	text_layer_set_text(music_song_layer, "No Title");
-	
-	
-	//init location layer
-	animated_layer[LOCATION_LAYER] = layer_create(GRect(30, 72, 75, 50));
-	layer_add_child(window_layer, animated_layer[LOCATION_LAYER]);
-	
-	location_street_layer = text_layer_create(GRect(0, 0, 75, 47));
-	text_layer_set_text_alignment(location_street_layer, GTextAlignmentCenter);
-	text_layer_set_text_color(location_street_layer, GColorWhite);
-	text_layer_set_background_color(location_street_layer, GColorClear);
-	text_layer_set_font(location_street_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
-	layer_add_child(animated_layer[LOCATION_LAYER], text_layer_get_layer(location_street_layer));
-	text_layer_set_text(location_street_layer, "Location not updated"); 	
+	if(weather_bitmap) {
+		graphics_draw_bitmap_in_rect(ctx, weather_bitmap, CANVAS_REGIONS[FIELD_WEATHER_ICON].frame);
+		prof_draw(1);
+	}
+	if(tomorrow_bitmap) {
+		graphics_draw_bitmap_in_rect(ctx, tomorrow_bitmap, CANVAS_REGIONS[FIELD_TOMORROW_ICON].frame);
+		prof_draw(1);
+	}
 
+	for(i = 0; i < NUM_CANVAS_TEXTS; i++) {
+		text = &CANVAS_TEXTS[i];
+		frame = CANVAS_REGIONS[text->field].frame;
+		panel = CANVAS_REGIONS[text->field].panel;
+		if(panel != NUM_LAYERS) {
+			if(!panel_shown(panel)) continue;
+			frame.origin.x += panel_x(panel);
+			frame.origin.y += PANEL_Y;
+		}
+
+		string = (text->slot < NUM_TEXTS) ? text_get(text->slot) : status_state.status;
+		if(!string) continue;
+		graphics_draw_text(ctx, string, canvas_fonts[text->font], frame, GTextOverflowModeWordWrap, text->align, NULL);
+		prof_draw(1);
+	}
+
+	// Sparklines, right-aligned so the newest column is always at the right edge
+	for(i = 0; i < NUM_SPARKS; i++) {
+		spark = &sparks[i];
+		panel = SPARK_PANELS[i];
+		if(!panel_shown(panel) || (spark->columns < 2)) continue;
+
+		frame = CANVAS_REGIONS[SPARK_FIELDS[i]].frame;
+		frame.origin.x += panel_x(panel) + SPARK_COLUMNS - spark->columns;
+		frame.origin.y += PANEL_Y;
+		for(j = 1; j < spark->columns; j++)
+			graphics_draw_line(ctx, GPoint(frame.origin.x + j - 1, frame.origin.y + spark->rows[j - 1]),
+					GPoint(frame.origin.x + j, frame.origin.y + spark->rows[j]));
+		prof_draw(spark->columns - 1);
+	}
+
+	if(music_progress_active && panel_shown(MUSIC_LAYER)) {
+		frame = CANVAS_REGIONS[FIELD_MUSIC_PROGRESS].frame;
+		graphics_fill_rect(ctx, GRect(frame.origin.x + panel_x(MUSIC_LAYER), frame.origin.y + PANEL_Y,
+				status_state.music_progress, frame.size.h), 0, GCornerNone);
+		prof_draw(1);
+	}
+}
+
+static void window_load(Window *this) {
+	Layer *window_layer = window_get_root_layer(this);
+	size_t heap_used = heap_bytes_used();
+	uint8_t i;
+
+	battery_image = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_BATTERY);
+	for(i = 0; i < NUM_GAUGES; i++)
+		gauge_icons[i] = gbitmap_create_with_resource(CANVAS_GAUGES[i].icon_resource);
+
+	canvas_fonts[FONT_SMALL] = fonts_get_system_font(FONT_KEY_GOTHIC_14);
+	canvas_fonts[FONT_SMALL_BOLD] = fonts_get_system_font(FONT_KEY_GOTHIC_14_BOLD);
+	canvas_fonts[FONT_MEDIUM] = fonts_get_system_font(FONT_KEY_GOTHIC_18);
+	canvas_fonts[FONT_MEDIUM_BOLD] = fonts_get_system_font(FONT_KEY_GOTHIC_18_BOLD);
+	canvas_fonts[FONT_LARGE_BOLD] = fonts_get_system_font(FONT_KEY_GOTHIC_24_BOLD);
+	canvas_fonts[FONT_TIME] = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_ROBOTO_BOLD_SUBSET_49));
+	canvas_fonts[FONT_CALENDAR] = canvas_fonts[FONT_LARGE_BOLD];
+
+	// One layer draws the whole screen from status_state, see CANVAS_REGIONS for the layout
+	canvas_layer = layer_create(layer_get_bounds(window_layer));
+	layer_set_update_proc(canvas_layer, canvas_update_callback);
+	layer_add_child(window_layer, canvas_layer);
+
+	panel_animation = animation_create();
+	animation_set_implementation(panel_animation, &PANEL_ANIMATION);
+	animation_set_duration(panel_animation, PANEL_SLIDE_DURATION);
+	animation_set_curve(panel_animation, AnimationCurveEaseInOut);
+	animation_set_handlers(panel_animation, (AnimationHandlers) {
+		.stopped = panel_animation_stopped,
+	}, NULL);
 	active_layer = LOCATION_LAYER;
-	
-	timerUpdateWeatherForecast = app_timer_register(5000, timer_cbk_nextdayweather, NULL);
+
+	status_state.phone_battery = 100;
+	status_state.pebble_battery = battery_state_service_peek().charge_percent;
+
+	// Icons are loaded by the first flush, once the cache had its say
+	status_state.weather_icon = 0;
+	status_state.tomorrow_icon = 0;
+	state_dirty |= (1 << FIELD_WEATHER_ICON) | (1 << FIELD_TOMORROW_ICON);
+
+	text_store(TEXT_WEATHER_TEMP, "-°", strlen("-°"));
+	text_store(TEXT_TOMORROW_TEMP, "../..", 5);
+	text_store(TEXT_CALENDAR_DATE, "No Upcoming", 11);
+	text_store(TEXT_CALENDAR_TEXT, "", 0);
+	text_store(TEXT_MUSIC_ARTIST, "No Artist", 9);
+	text_store(TEXT_MUSIC_TITLE, "No Title", 8);
+	text_store(TEXT_LOCATION, "Location not updated", 20);
+	text_store(TEXT_FORECAST, "No forecast", 11);
+	text_store(TEXT_STOCKS_TITLE, "Stocks", 6);
+	text_store(TEXT_STOCKS_PRICE, "-", 1);
+	text_store(TEXT_BITCOIN_TITLE, "Bitcoin", 7);
+	text_store(TEXT_BITCOIN_PRICE, "-", 1);
+	status_state.status = "Init.";
+
+	// Show the last known data straight away, the phone revalidates it in the background
+	cache_load();
 
 	if(DEBUG)
-		text_layer_set_text(text_status_layer, "Hello");
-	
-	sendCommandInt(SM_SCREEN_ENTER_KEY, STATUS_SCREEN_APP);
+		state_set_status("Hello");
+	state_flush();
 
-	// Start UI timers	
-	// timerSwapBottomLayer = app_timer_register(SWAP_BOTTOM_LAYER_INTERVAL, timer_cbk_layerswap, NULL);
-	timerUpdateGps = app_timer_register(updateGPSInterval, timer_cbk_gps, NULL);
-	timerUpdateMusic = app_timer_register(DEFAULT_SONG_UPDATE_INTERVAL, timer_cbk_music, NULL);
-	timerUpdateWeather = app_timer_register(updateWeatherInterval, timer_cbk_weather, NULL);
-	timerUpdateCalendar = app_timer_register(updateCalandarInterval, timer_cbk_calandar, NULL);
+	if(DEBUG)
+		APP_LOG(APP_LOG_LEVEL_DEBUG, "window_load: %d bytes heap, %d free", (int)(heap_bytes_used() - heap_used), (int)heap_bytes_free());
+	
+	// Start UI jobs
+	// sched_arm(JOB_LAYERSWAP, SWAP_BOTTOM_LAYER_INTERVAL);
+	cache_start_jobs();
+	sub_request();
 }
 
 static void pebble_battery_update(BatteryChargeState pb_bat) {
-	pebble_batteryPercent = pb_bat.charge_percent;
-	if(pebble_battery_low && (pebble_batteryPercent > 25)) pebble_battery_low = false;
-	if(!pebble_battery_low && (pebble_batteryPercent < 20)) {
+	prof_begin(PROF_BATTERY);
+	state_set_int(FIELD_PEBBLE_BATTERY, &status_state.pebble_battery, pb_bat.charge_percent);
+	if(pebble_battery_low && (status_state.pebble_battery > 25)) pebble_battery_low = false;
+	if(!pebble_battery_low && (status_state.pebble_battery < 20)) {
 		pebble_battery_low = true;
 		vibes_short_pulse();
 	}
-	layer_mark_dirty(pebble_battery_layer);
+	state_flush();
+
+	governor_update();
+	prof_end(PROF_BATTERY);
 }
 
 static void bluetooth_connection_handler(bool btConnected) {
+	TRACE(TRACE_LINK, TRACE_BLUETOOTH, btConnected, 0);
+
+	prof_begin(PROF_BLUETOOTH);
 	if(btConnected) {
-		text_layer_set_text(text_status_layer, "");
-		sendCommandInt(SM_SCREEN_ENTER_KEY, STATUS_SCREEN_APP);
-		
-		if(!timerUpdateWeather)
-			timerUpdateWeather = app_timer_register(updateWeatherInterval, timer_cbk_weather, NULL);
-		if(!timerUpdateCalendar)
-			timerUpdateCalendar = app_timer_register(updateCalandarInterval, timer_cbk_calandar, NULL);
-		//if(!timerSwapBottomLayer)
-			//timerSwapBottomLayer = app_timer_register(SWAP_BOTTOM_LAYER_INTERVAL, timer_cbk_layerswap, NULL);
-		if(!timerUpdateGps)
-			timerUpdateGps = app_timer_register(updateGPSInterval, timer_cbk_gps, NULL);
-		if(!timerUpdateMusic)
-			timerUpdateMusic = app_timer_register(DEFAULT_SONG_UPDATE_INTERVAL, timer_cbk_music, NULL);
+		state_set_status("");
+		link_reconnected();
+		sub_request();
+		refresh_batch_probed = refresh_batch_active;
+
+		// Timers pick up where the data left off, the sync brings the stale topics in by priority
+		governor_sync();
+		sync_start();
 	} else {
-		text_layer_set_text(text_status_layer, "No BT");
+		state_set_status("No BT");
+		sub_active = 0;
+		topic_sync.active = false;
 		
-		// Cancel all running timers
-		if(timerUpdateCalendar) {
-			app_timer_cancel(timerUpdateCalendar);
-			timerUpdateCalendar = NULL;
-		}
-		if(timerUpdateMusic) {
-			app_timer_cancel(timerUpdateMusic);
-			timerUpdateMusic = NULL;
-		}
-		if(timerUpdateWeather) {
-			app_timer_cancel(timerUpdateWeather);
-			timerUpdateWeather = NULL;
-		}
-		if(timerSwapBottomLayer) {
-			app_timer_cancel(timerSwapBottomLayer);
-			timerSwapBottomLayer = NULL;
-		}
-		if(timerUpdateGps) {
-			app_timer_cancel(timerUpdateGps);
-			timerUpdateGps = NULL;
-		}
-		if(timerRecoveryAttempt) {
-			app_timer_cancel(timerRecoveryAttempt);
-			timerRecoveryAttempt = NULL;
-		}
-		if(timerUpdateWeatherForecast) {
-			app_timer_cancel(timerUpdateWeatherForecast);
-			timerUpdateWeatherForecast = NULL;
-		}
+		// Cancel all pending jobs, the countdown carries on without the phone
+		sched_cancel_all();
+		link_down();
+		appt_update();
 	}
+
+	state_flush();
+	prof_end(PROF_BLUETOOTH);
 }
 
 static void accel_tep_handler(AccelAxisType axis, int32_t direction) {
+	prof_begin(PROF_TAP);
+
+	// Any flick means the watch is on a moving wrist
+	governor_last_motion = time(NULL);
+	governor_update();
+
 	if((axis == ACCEL_AXIS_Y) && (direction == -1))
 		swap_bottom_layer();
+
+	prof_end(PROF_TAP);
 }
 
 static void handle_minute_tick(struct tm* tick_time, TimeUnits units_changed) {
@@ -968,8 +3595,10 @@ static void handle_minute_tick(struct tm* tick_time, TimeUnits units_changed) {
   	static char time_text[] = "00:00";
   	static char date_text[] = "Xxxxxxxxx 00";
 	
+	prof_begin(PROF_TICK);
+
   	strftime(date_text, sizeof(date_text), "%b %e", tick_time);
-  	text_layer_set_text(text_date_layer, date_text);
+  	state_set_string(TEXT_DATE, date_text);
 
 
 	if (clock_is_24h_style()) {
@@ -982,81 +3611,67 @@ static void handle_minute_tick(struct tm* tick_time, TimeUnits units_changed) {
     	memmove(time_text, &time_text[1], sizeof(time_text) - 1);
 	}
 
-  	text_layer_set_text(text_time_layer, time_text);
+  	state_set_string(TEXT_TIME, time_text);
 	
-	apptDisplay();
+	// The bar job covers playback, this only catches a bar left without one
+	if(music_progress_active && (music_progress.state == MUSIC_PLAYING) && !sched_jobs[JOB_MUSICBAR].armed)
+		music_progress_update();
+	state_flush();
+
+	// Periodic jobs share this wake-up, at whatever cadence the tier allows
+	governor_update();
+	sched_run_due();
+
+	prof_end(PROF_TICK);
 }
 
 static void window_unload(Window *this) {
-	if(DEBUG)
-		LOCAL_DEBUG(APP_LOG_LEVEL_DEBUG, "Unloading main window");
+	uint8_t i;
+
+	TRACE(TRACE_LINK, TRACE_UNLOAD, 0, 0);
 	
 	// Notify iPhone App
 	sendCommandInt(SM_SCREEN_EXIT_KEY, STATUS_SCREEN_APP);
 	
-	// Cancel all running timers
-	if(timerUpdateCalendar) {
-		app_timer_cancel(timerUpdateCalendar);
-		timerUpdateCalendar = NULL;
-	}
-	if(timerUpdateMusic) {
-		app_timer_cancel(timerUpdateMusic);
-		timerUpdateMusic = NULL;
-	}
-	if(timerUpdateWeather) {
-		app_timer_cancel(timerUpdateWeather);
-		timerUpdateWeather = NULL;
-	}
-	if(timerSwapBottomLayer) {
-		app_timer_cancel(timerSwapBottomLayer);
-		timerSwapBottomLayer = NULL;
-	}
-	if(timerUpdateGps) {
-		app_timer_cancel(timerUpdateGps);
-		timerUpdateGps = NULL;
-	}
-	if(timerRecoveryAttempt) {
-		app_timer_cancel(timerRecoveryAttempt);
-		timerRecoveryAttempt = NULL;
-	}
-	if(timerUpdateWeatherForecast) {
-		app_timer_cancel(timerUpdateWeatherForecast);
-		timerUpdateWeatherForecast = NULL;
-	}
+	// Cancel all pending jobs
+	sched_cancel_all();
+
+	cache_save();
+	prof_report();
 	
 	
-	// Clean up UI elements
-	bitmap_layer_destroy(battery_image_layer);
-	bitmap_layer_destroy(weather_image);
-	bitmap_layer_destroy(weather_tomorrow_image);
-	text_layer_destroy(text_weather_tomorrow_temp_layer);
-	text_layer_destroy(text_weather_temp_layer);
-	text_layer_destroy(text_date_layer);
-	text_layer_destroy(text_time_layer);
-	text_layer_destroy(text_status_layer);
-	text_layer_destroy(calendar_date_layer);
-	text_layer_destroy(calendar_text_layer);
-	layer_destroy(calendar_layer);
-	text_layer_destroy(music_artist_layer);
-	text_layer_destroy(music_song_layer);
-	text_layer_destroy(location_street_layer);
-	layer_destroy(battery_layer);
-	layer_destroy(animated_layer[MUSIC_LAYER]);
-	layer_destroy(battery_ind_layer);
-	layer_destroy(weather_layer);
-	layer_destroy(animated_layer[LOCATION_LAYER]);
+	// Clean up UI elements, the animation first as stopping it redraws the canvas
+	animation_destroy(panel_animation);
+	layer_destroy(canvas_layer);
+	fonts_unload_custom_font(canvas_fonts[FONT_TIME]);
 
 	// Release resources
-	for (int8_t i=0; i<NUM_WEATHER_IMAGES; i++) {
-		gbitmap_destroy(weather_status_small_imgs[i]);
-	}
+	icon_cache_destroy();
 	gbitmap_destroy(battery_image);
-	gbitmap_destroy(phone_icon);
-	gbitmap_destroy(pebble_icon);
+	for(i = 0; i < NUM_GAUGES; i++)
+		gbitmap_destroy(gauge_icons[i]);
 }
 
 // App startup
 static void do_init(void) {
+	// Init global variables
+	appointment_time[0] = '\0';
+	text_arena_init();
+	governor_last_motion = time(NULL);
+	link_recovery.since = time(NULL);
+	srand(time(NULL));
+	record_start();
+
+	// Initialize messaging before the window loads, it sends its launch requests right away
+	app_message_register_inbox_received(rcv);
+	app_message_register_inbox_dropped(dropped);
+	app_message_register_outbox_sent(sent_ok);
+	app_message_register_outbox_failed(send_failed);
+	// Exactly what the protocol needs, the maximums only guard a phone table grown past the firmware
+	const uint32_t inbound_size = MIN(SM_INBOX_SIZE, app_message_inbox_size_maximum());
+	const uint32_t outbound_size = MIN(SM_OUTBOX_SIZE, app_message_outbox_size_maximum());
+	app_message_open(inbound_size, outbound_size);
+
 	// Create app's base window
 	window = window_create();
 	window_set_window_handlers(window, (WindowHandlers) {
@@ -1076,18 +3691,8 @@ static void do_init(void) {
 	battery_state_service_subscribe(pebble_battery_update);
 	bluetooth_connection_service_subscribe(bluetooth_connection_handler);
 	accel_tap_service_subscribe(accel_tep_handler);
-
-	// Initialize messaging
-	app_message_register_inbox_received(rcv);
-	app_message_register_inbox_dropped(dropped);
-	app_message_register_outbox_sent(sent_ok);
-	app_message_register_outbox_failed(send_failed);
-	const uint32_t inbound_size = app_message_inbox_size_maximum();
-	const uint32_t outbound_size = app_message_outbox_size_maximum();
-	app_message_open(inbound_size, outbound_size);
-
-	// Init global variables
-	appointment_time[0] = '\0';
+	accel_data_service_subscribe(ACTIVITY_BATCH, activity_handler);
+	accel_service_set_sampling_rate(ACCEL_SAMPLING_10HZ);
 }
 
 // Release resources
@@ -1097,9 +3702,11 @@ static void do_deinit(void) {
 	battery_state_service_unsubscribe();
 	bluetooth_connection_service_unsubscribe();
 	accel_tap_service_unsubscribe();
+	accel_data_service_unsubscribe();
 	
 	// Deregister messaging callbacks
 	app_message_deregister_callbacks();
+	record_stop();
 
 	// Release windows
 	window_destroy(window);